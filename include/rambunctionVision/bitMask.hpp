@@ -0,0 +1,180 @@
+/**
+ * @file bitMask.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Bit packed binary masks and morphology on them.
+ * @version 0.1
+ * @date 2021-02-10
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief A binary mask holding 64 pixels in each machine word.
+   *
+   * Pixel x of a row is bit (x % 64) of word (x / 64), so the leftmost pixel
+   * is the lowest bit. Bits past the last column of a row are always kept
+   * zero. A CV_8UC1 mask uses a whole byte for each pixel, so this moves an
+   * eighth of the memory, and whole words of pixels can be combined at once.
+   *
+   * @see BitMorphology
+   */
+  class BitMask {
+  public:
+    BitMask() = default;
+
+    /**
+     * @brief Creates an empty (all zero) mask.
+     *
+     * @param[in] size The size of the mask.
+     */
+    explicit BitMask(cv::Size size) { create(size); }
+
+    /**
+     * @brief Creates a mask from an 8-bit mask.
+     *
+     * @param[in] mask The CV_8UC1 mask, any non-zero pixel is set.
+     */
+    explicit BitMask(const cv::Mat& mask) { fromMat(mask); }
+
+    /**
+     * @brief Allocates the mask if its size changed and clears it.
+     *
+     * @param[in] size The size of the mask.
+     */
+    void create(cv::Size size);
+
+    /**
+     * @brief Packs an 8-bit mask.
+     *
+     * @param[in] mask The CV_8UC1 mask, any non-zero pixel is set.
+     */
+    void fromMat(const cv::Mat& mask);
+
+    /**
+     * @brief Unpacks the mask into an 8-bit mask for OpenCV (like cv::findContours).
+     *
+     * @param[out] mask The output CV_8UC1 mask of 0 and 255.
+     */
+    void toMat(cv::Mat& mask) const;
+
+    /**
+     * @brief The number of set pixels, counted a word at a time.
+     */
+    int area() const;
+
+    bool empty() const { return words.empty(); } /**< Whether the mask has no pixels. */
+    cv::Size size() const { return cv::Size(cols, rows); } /**< The size of the mask. */
+    int step() const { return stride; } /**< The number of words in each row. */
+
+    bool at(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; } /**< Whether a pixel is set. */
+
+    std::uint64_t* row(int y) { return words.data() + static_cast<std::size_t>(y) * stride; } /**< The words of a row. */
+    const std::uint64_t* row(int y) const { return words.data() + static_cast<std::size_t>(y) * stride; } /**< The words of a row. */
+
+    /**
+     * @brief The bits of the last word of a row that are inside the mask.
+     */
+    std::uint64_t lastWordBits() const { return (cols & 63) ? ((std::uint64_t(1) << (cols & 63)) - 1) : ~std::uint64_t(0); }
+
+  private:
+    std::vector<std::uint64_t> words;
+    int rows = 0, cols = 0, stride = 0;
+  };
+
+  /**
+   * @brief Erodes and dilates bit packed masks with a fixed structuring element.
+   *
+   * The kernel is broken into horizontal chords like BinaryMorphology. For
+   * each chord length, whether a run of that many pixels is set is found for
+   * 64 pixels at a time by repeatedly combining a row with a shifted copy of
+   * itself, so a run of length n only takes log2(n) shifts and ANDs (or ORs
+   * for dilation). Rectangular kernels combine rows in the same way. Pixels
+   * outside the mask are ignored the same way cv::erode and cv::dilate
+   * ignore them by default, and the buffers are reused between calls.
+   *
+   * @see BitMask BinaryMorphology
+   */
+  class BitMorphology {
+  public:
+    /**
+     * @brief Creates the morphology for a 3x3 rectangle, like OpenCV's default kernel.
+     */
+    BitMorphology() { setKernel(cv::Mat()); }
+
+    /**
+     * @brief Creates the morphology for a structuring element.
+     *
+     * @param[in] kernel The structuring element (non-zero elements are used).
+     * @param[in] anchor The anchor of the kernel, (-1,-1) for the center.
+     */
+    explicit BitMorphology(const cv::Mat& kernel, cv::Point anchor = cv::Point(-1, -1)) { setKernel(kernel, anchor); }
+
+    /**
+     * @brief Changes the structuring element and precomputes its chords.
+     *
+     * @param[in] kernel The structuring element (non-zero elements are used).
+     * @param[in] anchor The anchor of the kernel, (-1,-1) for the center.
+     */
+    void setKernel(const cv::Mat& kernel, cv::Point anchor = cv::Point(-1, -1));
+
+    /**
+     * @brief Erodes a bit packed mask.
+     *
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void erode(const rv::BitMask& src, rv::BitMask& dst);
+
+    /**
+     * @brief Dilates a bit packed mask.
+     *
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void dilate(const rv::BitMask& src, rv::BitMask& dst);
+
+    /**
+     * @brief Applies a morphological operation to a bit packed mask.
+     *
+     * @param[in] op The operation, one of cv::MORPH_ERODE, cv::MORPH_DILATE, cv::MORPH_OPEN, or cv::MORPH_CLOSE.
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void apply(int op, const rv::BitMask& src, rv::BitMask& dst);
+
+  private:
+    /**
+     * @brief A horizontal run of ones in the kernel, relative to the anchor.
+     */
+    struct Chord {
+      int dx; /**< The horizontal offset of the start of the chord. */
+      int dy; /**< The vertical offset of the chord. */
+      int run; /**< The index of the chord's length in `lengths`. */
+    };
+
+    template<bool Erode> void morphology(const rv::BitMask& src, rv::BitMask& dst);
+
+    cv::Size kernelSize;
+    cv::Point anchor;
+    bool isRect = true;
+    std::vector<Chord> chords;
+    std::vector<int> lengths;
+
+    // Buffers reused between calls.
+    std::vector<std::uint64_t> runs, vertical;
+    rv::BitMask between;
+  };
+}
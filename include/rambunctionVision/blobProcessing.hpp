@@ -0,0 +1,117 @@
+/**
+ * @file blobProcessing.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Functions and structs to find and proccess connected blobs in a mask.
+ * @version 0.1
+ * @date 2021-02-11
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "rambunctionVision/contourProcessing.hpp"
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief The statistics of a connected blob of pixels in a mask.
+   *
+   * @see BlobFinder findCircles
+   */
+  struct Blob {
+    int area; /**< The number of pixels in the blob. */
+    cv::Rect boundingBox; /**< The bounding box of the blob. */
+    cv::Point2d centroid; /**< The center of mass of the blob. */
+    double varianceX; /**< The variance of the x coordinates of the pixels (mu20 / m00). */
+    double covariance; /**< The covariance of the pixel coordinates (mu11 / m00). */
+    double varianceY; /**< The variance of the y coordinates of the pixels (mu02 / m00). */
+  };
+
+  /**
+   * @brief Finds 8-connected blobs in a mask in a single scan.
+   *
+   * Each row is broken into runs of set pixels, and each run is joined to
+   * the runs it touches in the row above with a union-find. The area,
+   * bounding box and moments of each run are found in closed form and
+   * added to its blob, so no label image or list of points is ever built.
+   * The buffers are kept between calls so a stream of masks can be
+   * processed without allocating.
+   *
+   * @see Blob findCircles
+   */
+  class BlobFinder {
+  public:
+    /**
+     * @brief Finds the blobs in a mask.
+     *
+     * @param[in] mask The input mask, any non-zero pixel is set.
+     * @param[out] blobs The statistics of each blob.
+     * @param[in] offset Added to every coordinate, so blobs from a region can be in full frame coordinates.
+     */
+    void find(const cv::Mat& mask, std::vector<rv::Blob>& blobs, cv::Point offset = cv::Point());
+
+  private:
+    /**
+     * @brief A run of set pixels in a row, and the blob it belongs to.
+     */
+    struct Run {
+      int start; /**< The first pixel of the run. */
+      int end; /**< One past the last pixel of the run. */
+      int label; /**< The label of the run's blob. */
+    };
+
+    /**
+     * @brief The sums a blob's statistics are found from.
+     */
+    struct Sums {
+      double m00, m10, m01, m20, m11, m02;
+      int minX, minY, maxX, maxY;
+    };
+
+    int root(int label);
+    void join(int a, int b);
+
+    std::vector<Run> previous, current;
+    std::vector<int> parents;
+    std::vector<Sums> sums;
+  };
+
+  /**
+   * @brief Finds the circle best matching each blob.
+   *
+   * The circle is centered on the blob's centroid, with the radius of a
+   * solid disc with the same second moments. The match is how round the
+   * blob is (the ratio of its principal axes) times how much of the ellipse
+   * with the same moments it fills, so holes and elongated blobs score lower.
+   * The matches have no contour, but can be used with estimateBallPose just
+   * like the ones from contours.
+   *
+   * @param[in] blobs The input blobs to be matched with circles.
+   * @param[in] minArea The minimum allowable blob area.
+   * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @return std::vector<rv::CircleMatch> The blobs matched with thier closest circle.
+   *
+   * @see Blob BlobFinder estimateBallPose
+   */
+  std::vector<rv::CircleMatch> findCircles(const std::vector<rv::Blob>& blobs, double minArea, double minMatch);
+
+  /**
+   * @brief Finds the circle best matching each blob, refering to the blob by index.
+   *
+   * @param[in] blobs The input blobs to be matched with circles.
+   * @param[in] minArea The minimum allowable blob area.
+   * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @param[out] matches The circles along with the index of thier blob.
+   *
+   * @see Blob IndexedCircleMatch estimateBallPose
+   */
+  void findCircles(const std::vector<rv::Blob>& blobs, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches);
+}
@@ -7,7 +7,10 @@
  * 
  * @copyright Copyright (c) 2021
  */
+#include <chrono>
+
 #include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
 
 /**
  * @brief 'Rambunction Vision' namespace to store shared code.
@@ -42,4 +45,43 @@ namespace rv {
       x.read(node);
     }
   }
+
+  /**
+   * @brief The current time in seconds on the steady clock.
+   *
+   * Unlike the wall clock it never jumps, so times from it can be
+   * subtracted to find how long something took.
+   *
+   * @return double The seconds since the steady clock's epoch.
+   */
+  static double steadyTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief Finds when the last frame grabbed from a capture was taken.
+   *
+   * Call it right after cv::VideoCapture::grab and before retrieve, so
+   * the time spent decoding the frame isn't counted. Drivers like V4L2
+   * stamp each frame when it's captured, on the same monotonic clock as
+   * the steady clock, which is earlier than when it's grabbed by however
+   * long it sat in the driver's buffer. That stamp is used when it's plausible, meaning
+   * it's in the last second and not in the future. Otherwise (a driver
+   * without stamps, or a video file whose position isn't a clock at all)
+   * the current time, right after the grab, is used instead.
+   *
+   * @param[in] capture The capture the frame was just grabbed from.
+   * @param[in] maxAge The oldest a driver stamp can be, in seconds, before it's ignored.
+   * @return double The capture time in seconds on the steady clock.
+   *
+   * @see steadyTime
+   */
+  static double captureTimestamp(const cv::VideoCapture& capture, double maxAge = 1.0) {
+    double now = rv::steadyTime();
+    double stamp = capture.get(cv::CAP_PROP_POS_MSEC) / 1000;
+    if (stamp > 0 && stamp <= now && now - stamp < maxAge) {
+      return stamp;
+    }
+    return now;
+  }
 }
\ No newline at end of file
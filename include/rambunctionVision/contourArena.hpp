@@ -0,0 +1,124 @@
+/**
+ * @file contourArena.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Contours stored in one flat buffer that is reused between frames.
+ * @version 0.1
+ * @date 2021-02-15
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief A list of contours with all of thier points in one buffer.
+   *
+   * cv::findContours allocates a vector for every contour it finds, every
+   * frame. Here the points of every contour go in one flat buffer, with the
+   * start and length of each contour kept in a second one. Both buffers,
+   * and the label image used to trace the contours, are kept between
+   * frames, so after the first frame finding contours allocates nothing.
+   *
+   * The outer borders are traced with the same border following algorithm
+   * as cv::findContours (Suzuki and Abe), giving the same contours as
+   * cv::RETR_EXTERNAL. Each contour can be given to OpenCV without copying
+   * it, as a matrix header over its points.
+   *
+   * @see RegionSearch findCircles findTargets
+   */
+  class ContourArena {
+  public:
+    /**
+     * @brief The position of a contour's points in the buffer.
+     */
+    struct Span {
+      int start; /**< The index of the contour's first point. */
+      int length; /**< The number of points in the contour. */
+    };
+
+    /**
+     * @brief Creates an empty arena.
+     *
+     * @param[in] method How to store the points, cv::CHAIN_APPROX_NONE or cv::CHAIN_APPROX_SIMPLE.
+     */
+    explicit ContourArena(int method = cv::CHAIN_APPROX_NONE) : method(method) {}
+
+    /**
+     * @brief Replaces the contours with the outer contours of a mask.
+     *
+     * @param[in] mask The CV_8UC1 mask, any non-zero pixel is set.
+     * @param[in] offset Added to every point, so contours from a region can be in full frame coordinates.
+     */
+    void find(const cv::Mat& mask, cv::Point offset = cv::Point()) {
+      clear();
+      add(mask, offset);
+    }
+
+    /**
+     * @brief Adds the outer contours of a mask to the ones already found.
+     *
+     * @param[in] mask The CV_8UC1 mask, any non-zero pixel is set.
+     * @param[in] offset Added to every point, so contours from a region can be in full frame coordinates.
+     */
+    void add(const cv::Mat& mask, cv::Point offset = cv::Point());
+
+    /**
+     * @brief Removes every contour, keeping the memory for the next frame.
+     */
+    void clear() {
+      points.clear();
+      spans.clear();
+    }
+
+    int size() const { return spans.size(); } /**< The number of contours. */
+    bool empty() const { return spans.empty(); } /**< Whether there are no contours. */
+
+    const cv::Point* begin(int i) const { return points.data() + spans[i].start; } /**< The first point of a contour. */
+    const cv::Point* end(int i) const { return begin(i) + spans[i].length; } /**< One past the last point of a contour. */
+    int length(int i) const { return spans[i].length; } /**< The number of points in a contour. */
+
+    /**
+     * @brief A CV_32SC2 matrix header over a contour's points, for OpenCV functions.
+     *
+     * The points aren't copied, so the header is only valid until the
+     * arena is changed.
+     *
+     * @param[in] i The index of the contour.
+     */
+    cv::Mat contour(int i) const { return cv::Mat(spans[i].length, 1, CV_32SC2, const_cast<cv::Point*>(begin(i))); }
+
+    /**
+     * @brief Copies the contours out, in the form cv::findContours gives them.
+     *
+     * @param[out] contours The output contours.
+     */
+    void toVectors(std::vector<std::vector<cv::Point>>& contours) const;
+
+    int method; /**< How the points are stored, cv::CHAIN_APPROX_NONE or cv::CHAIN_APPROX_SIMPLE. */
+
+  private:
+    /**
+     * @brief Follows a border from its first pixel, labeling it as it goes.
+     */
+    void trace(int row, int col, int from, int label, bool keep, cv::Point offset);
+
+    std::vector<cv::Point> points;
+    std::vector<Span> spans;
+
+    // Buffers reused between calls. The labels are a view
+    // of the buffer the size of the current mask.
+    cv::Mat labelBuffer, labels;
+    std::vector<int> parents;
+    std::vector<char> holes;
+  };
+}
@@ -15,11 +15,168 @@
 
 #include <opencv2/core.hpp>
 
+#include "rambunctionVision/contourArena.hpp"
+
 /**
  * @brief 'Rambunction Vision' namespace to store shared code.
  */
 namespace rv {
 
+  /**
+   * @brief The Hu moments of a shape, scaled the way cv::matchShapes compares them.
+   * 
+   * Each moment h is stored as 1 / (sign(h) * log10|h|), or 0 when it is
+   * too small to compare, so two shapes can be compared without finding
+   * thier moments again.
+   * 
+   * @see Target findTargets
+   */
+  struct HuMoments {
+    cv::Vec<double, 7> values; /**< The scaled Hu moments. */
+
+    HuMoments() = default;
+
+    /**
+     * @brief Finds the scaled Hu moments from the moments of a shape.
+     * 
+     * @param[in] moments The moments of the shape (from cv::moments).
+     */
+    explicit HuMoments(const cv::Moments& moments);
+
+    /**
+     * @brief Compares two shapes the same way as cv::CONTOURS_MATCH_I1.
+     * 
+     * @param[in] other The moments of the other shape.
+     * @return double How diffrent the shapes are (lower is better).
+     */
+    double compare(const rv::HuMoments& other) const;
+  };
+
+  /**
+   * @brief A shape projected so its bounding rotated rect fills a 255x255 frame.
+   * 
+   * This lines up contours with targets so thier orientation can be
+   * compared. The moments of the projected shape are kept so the four
+   * orientations of a contour can be compared without drawing them.
+   * 
+   * @see matchTargetPoints Target
+   */
+  struct NormalizedShape {
+    std::vector<cv::Point2f> points; /**< The projected points. */
+    cv::Mat transform; /**< The transform used to project the points. */
+    cv::Vec<double, 9> moments; /**< The first to third order moments about the center of the frame, scaled by the area and frame size. */
+
+    NormalizedShape() = default;
+
+    /**
+     * @brief Projects a shape into the frame and finds its moments.
+     * 
+     * @param[in] shape The shape to be projected.
+     */
+    explicit NormalizedShape(const std::vector<cv::Point2f>& shape);
+
+    /**
+     * @brief Projects a shape whose bounding rotated rect is already known.
+     * 
+     * @param[in] shape The shape to be projected.
+     * @param[in] bounds The shape's bounding rotated rect (from cv::minAreaRect).
+     */
+    NormalizedShape(const std::vector<cv::Point2f>& shape, const cv::RotatedRect& bounds);
+
+    /**
+     * @brief Projects a contour's points straight from its matrix header, without copying them.
+     * 
+     * @param[in] contour The CV_32SC2 points of the contour, like ContourArena::contour gives.
+     * @param[in] bounds The contour's bounding rotated rect (from cv::minAreaRect).
+     */
+    NormalizedShape(const cv::Mat& contour, const cv::RotatedRect& bounds);
+  };
+
+  /**
+   * @brief Measurements of a contour, each found the first time it's asked for.
+   * 
+   * Every stage measuring a contour reads from here, so nothing is found
+   * twice for the same contour, and cheap measurements like the bounding
+   * rect can reject a contour before anything costly is found. A record is
+   * only ever used by one thread at a time, and refers to the contour's
+   * points without copying them, so it's only valid until they change.
+   * 
+   * @see findFeatures findCircles findTargets matchTargetPoints
+   */
+  class ContourFeatures {
+  public:
+    ContourFeatures() = default;
+
+    /**
+     * @brief Creates a record for a contour.
+     * 
+     * @param[in] contour The CV_32SC2 points of the contour.
+     */
+    explicit ContourFeatures(const cv::Mat& contour) { reset(contour); }
+
+    /**
+     * @brief Forgets every measurement and switches to another contour, keeping the memory.
+     * 
+     * @param[in] contour The CV_32SC2 points of the contour.
+     */
+    void reset(const cv::Mat& contour) {
+      points = contour;
+      computed = 0;
+    }
+
+    const cv::Mat& contour() const { return points; } /**< The points of the contour. */
+
+    const cv::Rect& boundingRect(); /**< The upright bounding rect (from cv::boundingRect). */
+    double area(); /**< The area (from cv::contourArea, or the moments if they were already found). */
+    const cv::Moments& moments(); /**< The moments (from cv::moments). */
+    const rv::HuMoments& huMoments(); /**< The scaled Hu moments. */
+    const std::vector<cv::Point>& convexHull(); /**< The convex hull (from cv::convexHull). */
+    const cv::RotatedRect& minAreaRect(); /**< The bounding rotated rect, found from the convex hull. */
+
+  private:
+    enum {
+      BOUNDING_RECT = 1 << 0,
+      AREA          = 1 << 1,
+      MOMENTS       = 1 << 2,
+      HU_MOMENTS    = 1 << 3,
+      CONVEX_HULL   = 1 << 4,
+      MIN_AREA_RECT = 1 << 5
+    };
+
+    cv::Mat points;
+    int computed = 0; /**< Which measurements have been found. */
+
+    cv::Rect bounds;
+    double contourArea;
+    cv::Moments contourMoments;
+    rv::HuMoments hu;
+    std::vector<cv::Point> hull;
+    cv::RotatedRect rotatedBounds;
+  };
+
+  /**
+   * @brief Gets a feature record ready for each contour.
+   * 
+   * Nothing is measured until it's asked for. The records refer to the
+   * contours' points, so the contours must be kept until they're done with.
+   * 
+   * @param[in] contours The contours to describe.
+   * @param[out] features A record for each contour, reused between frames.
+   * 
+   * @see ContourFeatures
+   */
+  void findFeatures(const std::vector<std::vector<cv::Point>>& contours, std::vector<rv::ContourFeatures>& features);
+
+  /**
+   * @brief Gets a feature record ready for each contour in an arena.
+   * 
+   * @param[in] contours The contours to describe.
+   * @param[out] features A record for each contour, reused between frames.
+   * 
+   * @see ContourFeatures ContourArena
+   */
+  void findFeatures(const rv::ContourArena& contours, std::vector<rv::ContourFeatures>& features);
+
   /**
    * @brief A target shape and name.
    * 
@@ -28,6 +185,13 @@ namespace rv {
   struct Target {
     std::string name; /**< The name of the target. */
     std::vector<cv::Point2f> shape; /**< The shape of the target. */
+    rv::HuMoments huMoments; /**< The moments of the shape, kept up to date with updateCache. */
+    rv::NormalizedShape normalized; /**< The normalized shape, kept up to date with updateCache. */
+    std::vector<cv::Point3f> objectPoints; /**< The shape on the z = 0 plane for pose estimation, kept up to date with updateCache. */
+    std::vector<cv::Point2f> cachedShape; /**< The shape the cache was built for. */
+
+    bool cacheBuilt() const { return !shape.empty() && cachedShape == shape; } /**< Whether the cache is up to date with the shape. */
+    void updateCache(); /**< Finds the moments, normalized shape and object points if the shape has changed. */
 
     void write(cv::FileStorage& fs) const {
       fs << "{" << "Name" << name << "Shape" << shape << "}";
@@ -36,6 +200,7 @@ namespace rv {
     void read(const cv::FileNode& node) {
       node["Name"] >> name;
       node["Shape"] >> shape;
+      updateCache();
     }
   };
 
@@ -71,6 +236,7 @@ namespace rv {
     rv::TargetMatch match; /**< The matching target and contour. */
     cv::Mat tvec; /**< The translation (position) of the target. */
     cv::Mat rvec; /**< The rotation of the target. */
+    double error; /**< The RMS reprojection error of the pose in pixels. */
   };
 
   /**
@@ -82,7 +248,7 @@ namespace rv {
     float radius; /**< The radius of the ball. */
     cv::Point3f center; /**< The location of the center of the ball. */
 
-    std::vector<cv::Point3f> points(); /**< The center followed by the extreme points of the ball. */
+    std::vector<cv::Point3f> points() const; /**< The center followed by the extreme points of the ball. */
 
     void write(cv::FileStorage& fs) const {
       fs << "{" << "Radius" << radius << "Center" << center << "}";
@@ -115,8 +281,8 @@ namespace rv {
     float radius; /**< The circle radius. */
     cv::Point2f center; /**< The location of the center of the circle. */
 
-    double area(); /**< The area of the circle (pi*r^2). */
-    std::vector<cv::Point2f> points(); /**< The center followed by the extreme points of the circle. */
+    double area() const; /**< The area of the circle (pi*r^2). */
+    std::vector<cv::Point2f> points() const; /**< The center followed by the extreme points of the circle. */
   };
 
   /**
@@ -139,14 +305,121 @@ namespace rv {
     rv::CircleMatch circleMatch; /**< The matchin circle. */
     rv::Ball ball; /**< The corosponging ball. */
     cv::Mat tvec; /**< The translation (position) of the ball. */
-    cv::Mat rvec; /**< The rotation of the ball. */
+    cv::Mat rvec; /**< The rotation of the ball, always zero since a ball looks the same from every side. */
   };
 
+  /**
+   * @brief A contour and it's best matching target, both refered to by index.
+   * 
+   * Nothing is copied, so the contours and targets given to findTargets
+   * must be kept until the match is no longer used.
+   * 
+   * @see findTargets matchTargetPoints estimateTargetPose TargetMatch
+   */
+  struct IndexedTargetMatch {
+    int contour; /**< The index of the contour. */
+    int target; /**< The index of the best matching target. */
+    double match; /**< How good the match is. */
+    std::vector<cv::Point2f> imagePoints; /**< The corners of the contour in the same order as the target's shape (set by matchTargetPoints). */
+  };
+
+  /**
+   * @brief The estimated position of a target, refering to its match by index.
+   * 
+   * @see IndexedTargetMatch estimateTargetPose TargetPose
+   */
+  struct IndexedTargetPose {
+    int match; /**< The index of the match. */
+    int target; /**< The index of the target, so the pose can be found again next frame. */
+    cv::Point2f center; /**< The mean of the match's image points, so the pose can be found again next frame. */
+    cv::Mat tvec; /**< The translation (position) of the target. */
+    cv::Mat rvec; /**< The rotation of the target. */
+    double error; /**< The RMS reprojection error of the pose in pixels. */
+  };
+
+  /**
+   * @brief A contour's closest matching circle, refering to the contour by index.
+   * 
+   * @see findCircles estimateBallPose CircleMatch
+   */
+  struct IndexedCircleMatch {
+    int contour; /**< The index of the contour (or blob). */
+    rv::Circle circle; /**< The circle that best matches the contour. */
+    double match; /**< How good the match is (0.0 - 1.0). */
+  };
+
+  /**
+   * @brief The estimated position of a ball, refering to its circle by index.
+   * 
+   * @see IndexedCircleMatch estimateBallPose BallPose
+   */
+  struct IndexedBallPose {
+    int circle; /**< The index of the circle. */
+    cv::Mat tvec; /**< The translation (position) of the ball. */
+    cv::Mat rvec; /**< The rotation of the ball, always zero since a ball looks the same from every side. */
+  };
+
+  /**
+   * @brief Sets how many contours or matches a stage needs before it runs in parallel.
+   * 
+   * With only a few, starting the threads costs more than it saves, so
+   * they are processed serially.
+   * 
+   * @param[in] count The fewest items to process in parallel (8 by default).
+   * 
+   * @see parallelForEach
+   */
+  void setParallelThreshold(int count);
+
+  /**
+   * @brief Gets how many contours or matches a stage needs before it runs in parallel.
+   * 
+   * @see setParallelThreshold
+   */
+  int getParallelThreshold();
+
+  /**
+   * @brief Calls a function for each index, across OpenCV's threads when there are enough.
+   * 
+   * Runs serially when there are fewer than getParallelThreshold() indices.
+   * Each call should only write to the results for its own index, so the
+   * output is the same and in the same order either way.
+   * 
+   * @tparam Function A callable taking the int index.
+   * @param[in] count The number of indices [0, count).
+   * @param[in] function The function to call for each index.
+   */
+  template<typename Function>
+  void parallelForEach(int count, const Function& function) {
+    if (count < getParallelThreshold()) {
+      for (int i = 0; i < count; i++) {
+        function(i);
+      }
+      return;
+    }
+
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range) {
+      for (int i = range.start; i < range.end; i++) {
+        function(i);
+      }
+    });
+  }
+
   /**
    * @brief Approximates a contour to have n sides.
    * 
-   * The function iterativly attempts aproximations with a higher error
-   * untill one is found with n sides.
+   * Replaces trying cv::approxPolyDP with a higher error untill one is
+   * found with n sides, needing only one pass. A single Douglas-Peucker
+   * split of the contour finds the largest error each point would be kept
+   * at, so the error needed for n sides can be read off directly and
+   * rounded up to the next step.
+   * 
+   * The result is usually the same as the cv::approxPolyDP search, but not
+   * always. The contour is split at its first point and the point furthest
+   * from it, while cv::approxPolyDP picks its own starting points and
+   * afterwards removes points that are nearly in line with thier
+   * neighbours, so the two can keep diffrent points or need a diffrent
+   * error. The benchmark's ngon mode counts how often they disagree.
    * 
    * @param[in] src The input points.
    * @param[out] dst The output Points.
@@ -159,7 +432,7 @@ namespace rv {
    * 
    * @see matchTargetPoints
    */
-  bool approximateNGon(std::vector<cv::Point2f>& src, std::vector<cv::Point2f>& dst, int n, double start = 0, double end = 100, double step = 0.1);
+  bool approximateNGon(const std::vector<cv::Point2f>& src, std::vector<cv::Point2f>& dst, int n, double start = 0, double end = 100, double step = 0.1);
 
   /**
    * @brief Reorders a vector of points to start with the one closest to the origin.
@@ -189,28 +462,71 @@ namespace rv {
    * 
    * @see matchTargetPoints
    */
-  cv::Mat normalizedContourImage(std::vector<cv::Point2f> contour, std::vector<cv::Point2f>& projectedContour, cv::Mat& image);
+  cv::Mat normalizedContourImage(const std::vector<cv::Point2f>& contour, std::vector<cv::Point2f>& projectedContour, cv::Mat& image);
 
   /**
    * @brief Processes a match so the contour an target points aline.
    * 
    * Both the target and contour are transformed to fit in a 255x255 square.
-   * They are then drawn and their overlap is calculated at each orintation so
-   * they will have matching orientation. The contour points are simplifyed to
-   * have the same number of sides as the target, and the points of each are 
-   * reordered to assure corospondence becofre being transformed back to thier
-   * origional position.
+   * The moments of the contour are then compared with the target's at each
+   * of the four orintations, so they will have matching orientation without
+   * drawing either of them. The contour points are simplifyed to have the
+   * same number of sides as the target, and then reordered so each point
+   * corosponds to the same point of the target's shape before being
+   * transformed back to thier origional position. The match value is
+   * replaced by how closely the moments agree (1.0 is a perfect match).
    * 
    * @param[in] matches The input vector of matches.
    * @return std::vector<rv::TargetMatch> the ouput processed matches.
    * 
-   * @see TargetMatch normalizedContourImage approximateNGon reorderPoints
+   * @see TargetMatch NormalizedShape approximateNGon reorderPoints
+   */
+  std::vector<rv::TargetMatch> matchTargetPoints(const std::vector<rv::TargetMatch>& matches);
+
+  /**
+   * @brief Finds the contour points corosponding to each point of the target.
+   * 
+   * The same as matchTargetPoints, but the points are stored in each match's
+   * image points, in the order of the target's own shape. Matches that can't
+   * be simplified to the target's shape are removed.
+   * 
+   * @param[in] contours The contours the matches refer to.
+   * @param[in] targets The targets the matches refer to.
+   * @param[in,out] matches The matches to find the image points of.
+   * 
+   * @see IndexedTargetMatch findTargets estimateTargetPose
    */
-  std::vector<rv::TargetMatch> matchTargetPoints(std::vector<rv::TargetMatch>& matches);
+  void matchTargetPoints(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the contour points corosponding to each point of the target.
+   * 
+   * @param[in] contours The contours the matches refer to.
+   * @param[in] targets The targets the matches refer to.
+   * @param[in,out] matches The matches to find the image points of.
+   * 
+   * @see ContourArena IndexedTargetMatch
+   */
+  void matchTargetPoints(const rv::ContourArena& contours, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the image points of matches using the features of thier contours.
+   * 
+   * @param[in,out] features The features of the contours the matches refer to.
+   * @param[in] targets The targets the matches refer to.
+   * @param[in,out] matches The matches to process, failed ones are removed.
+   * 
+   * @see ContourFeatures IndexedTargetMatch
+   */
+  void matchTargetPoints(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches);
 
   /**
    * @brief Finds the targets that best matches each contour.
    * 
+   * The moments of each contour are only found once, and are compared with
+   * each target's cached moments (see Target::updateCache). Targets
+   * whose moments are out of date have them found once per call instead.
+   * 
    * @param[in] contours The input contours to be matched.
    * @param[in] targets The targets to match the contours against.
    * @param[in] minArea The minimum contour area allowable.
@@ -219,11 +535,56 @@ namespace rv {
    * 
    * @see Target TargetMatch
    */
-  std::vector<rv::TargetMatch> findTargets(std::vector<std::vector<cv::Point>> contours, std::vector<rv::Target> targets, double minArea, double maxMatch);
+  std::vector<rv::TargetMatch> findTargets(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch);
+
+  /**
+   * @brief Finds the targets that best matches each contour without copying them.
+   * 
+   * @param[in] contours The input contours to be matched.
+   * @param[in] targets The targets to match the contours against.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   * 
+   * @see Target IndexedTargetMatch
+   */
+  void findTargets(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the targets that best matches each contour in an arena.
+   * 
+   * @param[in] contours The input contours to be matched.
+   * @param[in] targets The targets to match the contours against.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   * 
+   * @see ContourArena IndexedTargetMatch
+   */
+  void findTargets(const rv::ContourArena& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the targets that best matches each contour using thier features.
+   * 
+   * Contours whose bounding rect is smaller than minArea are rejected
+   * before thier moments are found.
+   * 
+   * @param[in,out] features The features of the contours to be matched.
+   * @param[in] targets The targets to compare the contours to.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   * 
+   * @see ContourFeatures IndexedTargetMatch
+   */
+  void findTargets(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
 
   /**
    * @brief Estimates the target position using a solvePnP.
    * 
+   * Targets are flat, so the pose is solved with cv::SOLVEPNP_IPPE on
+   * undistorted points when there are at least 4 of them.
+   * 
    * @param[in] matches Input matches to solve the position for.
    * @param[in] cameraMatrix The intrnsic camera matrix for 2d-3d corospondence.
    * @param[in] distortion The coefficents to acount for lense distortion.
@@ -231,7 +592,55 @@ namespace rv {
    * 
    * @see TargetMatch TargetPose
    */
-  std::vector<rv::TargetPose> estimateTargetPose(std::vector<TargetMatch> matches, cv::Mat cameraMatrix, cv::Mat distortion);
+  std::vector<rv::TargetPose> estimateTargetPose(const std::vector<rv::TargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion);
+
+  /**
+   * @brief Estimates the position of matches found by matchTargetPoints.
+   * 
+   * Targets are flat, so the image points of every match are undistorted
+   * in one call and each pose is solved with cv::SOLVEPNP_IPPE, using the
+   * object points cached in each target.
+   * 
+   * @param[in] targets The targets the matches refer to.
+   * @param[in] matches Input matches to solve the position for.
+   * @param[in] cameraMatrix The intrnsic camera matrix for 2d-3d corospondence.
+   * @param[in] distortion The coefficents to acount for lense distortion.
+   * @param[out] poses The solved position of each match.
+   * 
+   * @see IndexedTargetMatch IndexedTargetPose
+   */
+  void estimateTargetPose(const std::vector<rv::Target>& targets, const std::vector<rv::IndexedTargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion, std::vector<rv::IndexedTargetPose>& poses);
+
+  /**
+   * @brief Estimates the position of matches, starting from last frame's poses.
+   * 
+   * Each match is paired with the closest of last frame's poses for the
+   * same target, if one is within the size of the match. That pose is
+   * refined with a few Levenberg-Marquardt iterations rather than solving
+   * from scratch. If the refined pose reprojects with too much error, or
+   * no earlier pose is close, the match is solved from scratch instead.
+   * 
+   * @param[in] targets The targets the matches refer to.
+   * @param[in] matches Input matches to solve the position for.
+   * @param[in] cameraMatrix The intrnsic camera matrix for 2d-3d corospondence.
+   * @param[in] distortion The coefficents to acount for lense distortion.
+   * @param[in] previous The poses from last frame (must not be the same vector as poses).
+   * @param[in] maxError The largest RMS reprojection error in pixels to accept from a refined pose.
+   * @param[out] poses The solved position of each match.
+   * 
+   * @see IndexedTargetMatch IndexedTargetPose
+   */
+  void estimateTargetPose(const std::vector<rv::Target>& targets, const std::vector<rv::IndexedTargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion, const std::vector<rv::IndexedTargetPose>& previous, double maxError, std::vector<rv::IndexedTargetPose>& poses);
+
+  /**
+   * @brief Methods to fit a circle to a contour and score how circular it is.
+   * 
+   * @see findCircles
+   */
+  enum CircleMethods {
+    CIRCLE_ENCLOSING = 0, /**< cv::minEnclosingCircle, scored by how much of it the contour fills. */
+    CIRCLE_ALGEBRAIC = 1  /**< A least squares (Kasa) fit, scored by how far the points spread from it. */
+  };
 
   /**
    * @brief Find the closest matchng circle of a contour.
@@ -239,15 +648,69 @@ namespace rv {
    * @param[in] contours The input contours to be matched with circles.
    * @param[in] minArea The minimum allowable contour area.
    * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @param[in] method How to fit and score the circles (see CircleMethods).
    * @return std::vector<rv::CircleMatch> The output contours matched with thier closest matching circle.
    * 
    * @see Circle CircleMatch estimateBallPose Ball BallPose
    */
-  std::vector<rv::CircleMatch> findCircles(std::vector<std::vector<cv::Point>> contours, double minArea, double minMatch);
+  std::vector<rv::CircleMatch> findCircles(const std::vector<std::vector<cv::Point>>& contours, double minArea, double minMatch, int method = CIRCLE_ENCLOSING);
+
+  /**
+   * @brief Find the closest matchng circle of a contour without copying it.
+   * 
+   * The algebraic method is a single pass over the contour's points and,
+   * since it fits the points rather than enclosing them, still finds the
+   * right circle when part of a ball is hidden. Its match is 1 minus the
+   * RMS distance of the points from the circle (less the spread from the
+   * pixel grid) over a tenth of the radius.
+   * 
+   * @param[in] contours The input contours to be matched with circles.
+   * @param[in] minArea The minimum allowable contour area.
+   * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @param[out] matches The circles along with the index of thier contour.
+   * @param[in] method How to fit and score the circles (see CircleMethods).
+   * 
+   * @see Circle IndexedCircleMatch estimateBallPose
+   */
+  void findCircles(const std::vector<std::vector<cv::Point>>& contours, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method = CIRCLE_ENCLOSING);
+
+  /**
+   * @brief Find the closest matchng circle of each contour in an arena.
+   * 
+   * @param[in] contours The input contours to be matched with circles.
+   * @param[in] minArea The minimum allowable contour area.
+   * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @param[out] matches The circles along with the index of thier contour.
+   * @param[in] method How to fit and score the circles (see CircleMethods).
+   * 
+   * @see ContourArena IndexedCircleMatch
+   */
+  void findCircles(const rv::ContourArena& contours, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method = CIRCLE_ENCLOSING);
+
+  /**
+   * @brief Find the closest matchng circle of each contour using thier features.
+   * 
+   * Contours whose bounding rect is smaller than minArea are rejected
+   * before anything else is found.
+   * 
+   * @param[in,out] features The features of the contours to be matched.
+   * @param[in] minArea The minimum allowable contour area.
+   * @param[in] minMatch The minimum allowable match value (0.0-1.0).
+   * @param[out] matches The circles along with the index of thier contour.
+   * @param[in] method How to fit and score the circles (see CircleMethods).
+   * 
+   * @see ContourFeatures IndexedCircleMatch
+   */
+  void findCircles(std::vector<rv::ContourFeatures>& features, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method = CIRCLE_ENCLOSING);
 
   /**
    * @brief Estimates the position of a ball
    * 
+   * The position is found directly rather than with solvePnP. The edge
+   * of each circle is undistorted to find how wide the ball looks, which
+   * with the ball's radius gives how far away it is along the ray through
+   * the circle's center. The rotation is always zero.
+   * 
    * @param[in] circles The circles to find the position of.
    * @param[in] ball The size of the balls to find the position of.
    * @param[in] cameraMatrix The intrnsic camera matrix for 2d-3d corospondence.
@@ -256,5 +719,18 @@ namespace rv {
    * 
    * @see CircleMatch BallPose findCircles Cirlce Ball
    */
-  std::vector<rv::BallPose> estimateBallPose(std::vector<CircleMatch> circles, rv::Ball ball, cv::Mat cameraMatrix, cv::Mat distortion);
+  std::vector<rv::BallPose> estimateBallPose(const std::vector<rv::CircleMatch>& circles, const rv::Ball& ball, const cv::Mat& cameraMatrix, const cv::Mat& distortion);
+
+  /**
+   * @brief Estimates the position of a ball without copying its circle.
+   * 
+   * @param[in] circles The circles to find the position of.
+   * @param[in] ball The size of the balls to find the position of.
+   * @param[in] cameraMatrix The intrnsic camera matrix for 2d-3d corospondence.
+   * @param[in] distortion The coefficents to acount for lense distortion.
+   * @param[out] poses The position of each ball.
+   * 
+   * @see IndexedCircleMatch IndexedBallPose findCircles
+   */
+  void estimateBallPose(const std::vector<rv::IndexedCircleMatch>& circles, const rv::Ball& ball, const cv::Mat& cameraMatrix, const cv::Mat& distortion, std::vector<rv::IndexedBallPose>& poses);
 }
\ No newline at end of file
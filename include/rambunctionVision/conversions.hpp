@@ -30,7 +30,7 @@ namespace rv {
    * @return std::vector<cv::Point_<_OutType>> The output converted points.
    */
   template<typename _OutType, typename _InType>
-  std::vector<cv::Point_<_OutType>> convertToPoints(std::vector<cv::Point_<_InType>>& input) {
+  std::vector<cv::Point_<_OutType>> convertToPoints(const std::vector<cv::Point_<_InType>>& input) {
     std::vector<cv::Point_<_OutType>> output(input.size());
     std::transform(input.begin(), input.end(), output.begin(), [](const cv::Point_<_InType>& p) {
       return cv::Point_<_OutType>(static_cast<_OutType>(p.x), static_cast<_OutType>(p.y));
@@ -50,7 +50,7 @@ namespace rv {
    * @return std::vector<cv::Point_<_OutType>> The output converted points.
    */
   template<typename _OutType, typename _InType>
-  std::vector<cv::Point_<_OutType>> convertToPoints(std::vector<cv::Point3_<_InType>>& input) {
+  std::vector<cv::Point_<_OutType>> convertToPoints(const std::vector<cv::Point3_<_InType>>& input) {
     std::vector<cv::Point_<_OutType>> output(input.size());
     std::transform(input.begin(), input.end(), output.begin(), [](const cv::Point3_<_InType>& p) {
       return cv::Point_<_OutType>(static_cast<_OutType>(p.x), static_cast<_OutType>(p.y));
@@ -70,7 +70,7 @@ namespace rv {
    * @return std::vector<cv::Point3_<_OutType>> The output converted points.
    */
   template<typename _OutType, typename _InType>
-  std::vector<cv::Point3_<_OutType>> convertToPoints3(std::vector<cv::Point_<_InType>>& input) {
+  std::vector<cv::Point3_<_OutType>> convertToPoints3(const std::vector<cv::Point_<_InType>>& input) {
     std::vector<cv::Point3_<_OutType>> output(input.size());
     std::transform(input.begin(), input.end(), output.begin(), [](const cv::Point_<_InType>& p) {
       return cv::Point3_<_OutType>(static_cast<_OutType>(p.x), static_cast<_OutType>(p.y), 0);
@@ -89,7 +89,7 @@ namespace rv {
    * @return std::vector<cv::Point3_<_OutType>> The output converted points.
    */
   template<typename _OutType, typename _InType>
-  std::vector<cv::Point3_<_OutType>> convertToPoints3(std::vector<cv::Point3_<_InType>>& input) {
+  std::vector<cv::Point3_<_OutType>> convertToPoints3(const std::vector<cv::Point3_<_InType>>& input) {
     std::vector<cv::Point3_<_OutType>> output(input.size());
     std::transform(input.begin(), input.end(), output.begin(), [](const cv::Point3_<_InType>& p) {
       return cv::Point3_<_OutType>(static_cast<_OutType>(p.x), static_cast<_OutType>(p.y), static_cast<_OutType>(p.z));
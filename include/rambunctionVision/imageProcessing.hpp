@@ -15,19 +15,81 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "rambunctionVision/morphology.hpp"
+
 /**
  * @brief 'Rambunction Vision' namespace to store shared code.
  */
 namespace rv {
 
+  /**
+   * @brief Lookup table of which BGR colors fall inside an hsv threshold.
+   * 
+   * Each color channel is quantized to a number of bits, and one bit is 
+   * stored for every quantized color. It is built once from the threshold
+   * bounds so classifying a pixel is a single lookup instead of a conversion
+   * to HSV and a range check. With the default 6 bits the whole table is
+   * 32KB and stays in cache. Colors are classified by the center of thier
+   * quantization cell, so pixels right on the edge of the threshold may be
+   * classified diffrently than cv::inRange would.
+   * 
+   * @see Threshold thresholdImage
+   */
+  class ColorTable {
+  public:
+    /**
+     * @brief Builds the table for an hsv range.
+     * 
+     * @param[in] low The lower bound of the hsv threshold.
+     * @param[in] high The upper bound of the hsv threshold.
+     * @param[in] bits The number of bits to keep from each color channel (1-8).
+     */
+    void build(const cv::Scalar_<int>& low, const cv::Scalar_<int>& high, int bits = 6);
+
+    /**
+     * @brief Whether the table was built for the given hsv range.
+     */
+    bool builtFor(const cv::Scalar_<int>& low, const cv::Scalar_<int>& high) const {
+      return !table.empty() && low == tableLow && high == tableHigh;
+    }
+
+    /**
+     * @brief Whether a BGR color falls inside the threshold.
+     * 
+     * A table that hasn't been built yet contains nothing.
+     */
+    bool contains(uchar b, uchar g, uchar r) const {
+      if (table.empty()) {
+        return false;
+      }
+      int index = ((b >> shift) << (2 * bits)) | ((g >> shift) << bits) | (r >> shift);
+      return (table.data[index >> 3] >> (index & 7)) & 1;
+    }
+
+    /**
+     * @brief Classifies every pixel of a BGR image.
+     * 
+     * @param[in] src The input BGR image.
+     * @param[out] dst The output mask.
+     */
+    void apply(const cv::Mat& src, cv::Mat& dst) const;
+
+  private:
+    cv::Mat table; /**< The bit packed table (reference counted so copies are cheap). */
+    cv::Scalar_<int> tableLow, tableHigh; /**< The bounds the table was built for. */
+    int bits = 0, shift = 8;
+  };
+
   /**
    * @brief Structer holding data to threshold an image.
    * 
    * Holds the high and low values for thresholding in the hsv color space, as
    * well as varables to determin the blur size and morphology matrices to
-   * remove noise and close holes.
+   * remove noise and close holes. If the low hue is larger than the high hue
+   * the hue range wraps around 180, so colors like red can be thresheld with
+   * a single range.
    * 
-   * @see thresholdImage
+   * @see thresholdImage ColorTable
    */
   struct Threshold {
     cv::Scalar_<int> high = {180, 255, 255}; /**< The upper bound of the hsv threshold. */
@@ -38,6 +100,11 @@ namespace rv {
     cv::Mat openMatrix  = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(15,15)); /**< The kernal to remove noise in thresholding. */
     cv::Mat closeMatrix = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(15,15)); /**< The kernal to close holes in thresholding. */
 
+    rv::ColorTable table; /**< Lookup table for the hsv bounds, kept up to date with updateTable. */
+
+    bool wrapsHue() const { return low[0] > high[0]; } /**< Whether the hue range wraps around 180. */
+    void updateTable() { if (!table.builtFor(low, high)) table.build(low, high); } /**< Rebuilds the lookup table if the bounds have changed. */
+
     int& highH() { return high[0]; } /**< Gets a refrece to the hue part of the high scalar. */
     int& lowH()  { return low[0];  } /**< Gets a refrece to the hue part of the low scalar. */
     int& highS() { return high[1]; } /**< Gets a refrece to the saturation part of the high scalar. */
@@ -62,6 +129,7 @@ namespace rv {
       node["BlurSize"] >> blurSize;
       node["OpenMatrix"] >> openMatrix;
       node["CloseMatrix"] >> closeMatrix;
+      updateTable();
     }
   };
 
@@ -77,20 +145,180 @@ namespace rv {
     }
   }
 
+  /**
+   * @brief Methods to blur, convert and threshold an image.
+   * 
+   * @see thresholdImage fusedThreshold ColorTable
+   */
+  enum ThresholdMethods {
+    THRESHOLD_LEGACY = 0, /**< Seperate full frame calls to blur, cvtColor and inRange. */
+    THRESHOLD_FUSED  = 1, /**< A single pass over the image with fusedThreshold. */
+    THRESHOLD_TABLE  = 2  /**< A blur followed by classifying pixels with the threshold's ColorTable. */
+  };
+
+  /**
+   * @brief Blurs, converts and thresholds an image in a single pass.
+   * 
+   * Each output row is computed from running column sums of the rows in the
+   * blur window, so only a few rows of the source are ever being worked on.
+   * The blur, HSV conversion and range check are done on each pixel while it
+   * is still in cache, and only the 8-bit mask is ever written out. The
+   * output matches the cv::blur, cv::cvtColor and cv::inRange path, other
+   * than where OpenCV's fixed point blur rounds an average diffrently.
+   * 
+   * @param[in] src The input BGR image.
+   * @param[out] dst The output mask before any morphology.
+   * @param[in] threshold The parameters to threshold the image by.
+   * 
+   * @see Threshold thresholdImage
+   */
+  void fusedThreshold(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold);
+
+  /**
+   * @brief Reusable buffers to threshold a stream of frames.
+   * 
+   * Owns every intermediate image and row buffer used to threshold a frame,
+   * so once the first frame has been processed (or the buffers were reserved
+   * for the camera resolution), thresholding frames of the same size, or
+   * regions of them, never allocates new images. Smaller images are worked
+   * on through views of the top left of the buffers. Morphology with large
+   * kernels is done with a BinaryMorphology for each kernel, which is only
+   * rebuilt when the kernel changes.
+   * 
+   * Not every path is free of allocations. OpenCV can still allocate
+   * internally in cv::blur (the legacy and table methods), cv::cvtColor
+   * and cv::inRange (the legacy method), and cv::morphologyEx, which is
+   * used for kernels small enough not to need a BinaryMorphology. Changing
+   * the threshold's range or kernels also rebuilds the ColorTable or
+   * BinaryMorphology, and applying several thresholds at once builds a
+   * small list of ranges each call. Only a single threshold with the fused
+   * method and large kernels never allocates once warmed up.
+   * 
+   * @see Threshold ThresholdMethods thresholdImage BinaryMorphology
+   */
+  class ThresholdContext {
+  public:
+    /**
+     * @brief Creates a context whose buffers are allocated on the first frame.
+     * 
+     * @param[in] method How to blur, convert and threshold the image (see ThresholdMethods).
+     */
+    explicit ThresholdContext(int method = THRESHOLD_LEGACY) : method(method) {}
+
+    /**
+     * @brief Creates a context with buffers already sized for the camera resolution.
+     * 
+     * @param[in] frameSize The size of the frames that will be thresheld.
+     * @param[in] method How to blur, convert and threshold the image (see ThresholdMethods).
+     */
+    ThresholdContext(cv::Size frameSize, int method = THRESHOLD_LEGACY) : method(method) { reserve(frameSize); }
+
+    /**
+     * @brief Allocates all the buffers needed for frames of the given size.
+     * 
+     * @param[in] frameSize The size of the frames that will be thresheld.
+     */
+    void reserve(cv::Size frameSize);
+
+    /**
+     * @brief Thresholds an image in the HSV color space.
+     * 
+     * Does the same as thresholdImage, but using the buffers held by the
+     * context. If `dst` already has the size of the frame it is written
+     * into directly.
+     * 
+     * @param[in] src The input image.
+     * @param[out] dst The output thresheld image.
+     * @param[in] threshold The parameters to threshold the image by.
+     */
+    void apply(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold);
+
+    /**
+     * @brief Thresholds an image with several thresholds at once.
+     * 
+     * Thresholds with the same blur size share a single blur and HSV
+     * conversion (or with the fused method, a single pass over the image),
+     * so finding power cells and targets from one camera doesn't cost two
+     * full pipelines.
+     * 
+     * @param[in] src The input image.
+     * @param[out] dst One output thresheld image for each threshold.
+     * @param[in] thresholds The parameters to threshold the image by.
+     */
+    void apply(const cv::Mat& src, std::vector<cv::Mat>& dst, const std::vector<rv::Threshold>& thresholds);
+
+    int method; /**< How to blur, convert and threshold the image (see ThresholdMethods). */
+
+  private:
+    cv::Mat blur, hsv, thresh, open, upper;
+    std::vector<int> sums, columns;
+    rv::ColorTable table; /**< Used when the threshold's own table is out of date. */
+    rv::BinaryMorphology openMorphology, closeMorphology;
+
+    // Buffers for each threshold when several are applied at once.
+    std::vector<cv::Mat> masks;
+    std::vector<rv::ColorTable> tables;
+    std::vector<rv::BinaryMorphology> openMorphologies, closeMorphologies;
+  };
+
+  /**
+   * @brief Thresholds frames in horizontal bands across all cores.
+   *
+   * The frame is split into one band per thread, and each band runs the
+   * whole blur, convert, threshold, open and close chain on its own worker
+   * with its own ThresholdContext, so the data stays in that core's cache
+   * and there is no barrier between the stages. Each band is extended by a
+   * halo of rows above and below, sized to the morphology kernels, so every
+   * output row is computed from the same pixels it would be in a single
+   * call. The blur reads pixels past the band from the frame itself, so the
+   * mask is bit-identical to ThresholdContext::apply.
+   *
+   * @see ThresholdContext thresholdImage
+   */
+  class ParallelThresholdContext {
+  public:
+    /**
+     * @brief Creates a context whose buffers are allocated on the first frame.
+     *
+     * @param[in] method How to blur, convert and threshold the image (see ThresholdMethods).
+     */
+    explicit ParallelThresholdContext(int method = THRESHOLD_LEGACY) : method(method) {}
+
+    /**
+     * @brief Thresholds an image in the HSV color space.
+     *
+     * @param[in] src The input image.
+     * @param[out] dst The output thresheld image.
+     * @param[in] threshold The parameters to threshold the image by.
+     */
+    void apply(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold);
+
+    int method; /**< How to blur, convert and threshold the image (see ThresholdMethods). */
+
+  private:
+    std::vector<rv::ThresholdContext> contexts; /**< One context per band. */
+    std::vector<cv::Mat> masks; /**< The mask of each band including its halo. */
+  };
+
   /**
    * @brief Thresholds an image in the HSV color space.
    * 
    * The function fist blurs the image, then the image is then converted into
    * the HSV color space to be thresheld. After thresholding, two 
    * morphalogical operations are applied to close any holes and remove noise.
+   * This is the legacy interface. It thresholds with a ThresholdContext
+   * kept for each thread, so its buffers are reused between calls, but
+   * it's shared by every caller on that thread. When thresholding a stream
+   * of frames, a ThresholdContext of the caller's own should be used instead.
    * 
    * @param[in] src The input image.
    * @param[out] dst The output thresheld image.
    * @param[in] threshold The parameters to threshold the image by.
+   * @param[in] method How to blur, convert and threshold the image (see ThresholdMethods).
    * 
-   * @see Threshold
+   * @see Threshold ThresholdMethods ThresholdContext fusedThreshold
    */
-  void thresholdImage(cv::Mat& src, cv::Mat& dst, rv::Threshold threshold);
+  void thresholdImage(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold, int method = THRESHOLD_LEGACY);
 
   /**
    * @brief Extracs all the image files from a given directory
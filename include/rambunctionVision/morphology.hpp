@@ -0,0 +1,121 @@
+/**
+ * @file morphology.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Fast morphology on binary masks with large kernels.
+ * @version 0.1
+ * @date 2021-02-06
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief Erodes and dilates binary masks with a fixed structuring element.
+   *
+   * Rectangular kernels are split into a horizontal and vertical pass, each
+   * using the van Herk/Gil-Werman algorithm, so the cost per pixel does not
+   * depend on the size of the kernel. Any other kernel is broken down into
+   * horizontal chords (runs of ones in each kernel row). A table of how far
+   * each pixel's run of ones extends to the right then tells if a whole
+   * chord fits, so the cost per pixel is one comparison per chord instead of
+   * one per kernel element.
+   *
+   * Masks must only hold the values 0 and 255. Pixels outside the image are
+   * ignored the same way cv::erode and cv::dilate ignore them by default.
+   * The object keeps its own buffers, so after the first mask of a given size
+   * nothing is allocated.
+   *
+   * @see Threshold ThresholdContext
+   */
+  class BinaryMorphology {
+  public:
+    BinaryMorphology() = default;
+
+    /**
+     * @brief Creates the morphology for a structuring element.
+     *
+     * @param[in] kernel The structuring element (non-zero elements are used).
+     * @param[in] anchor The anchor of the kernel, (-1,-1) for the center.
+     */
+    explicit BinaryMorphology(const cv::Mat& kernel, cv::Point anchor = cv::Point(-1, -1)) { setKernel(kernel, anchor); }
+
+    /**
+     * @brief Changes the structuring element and precomputes its chords.
+     *
+     * @param[in] kernel The structuring element (non-zero elements are used).
+     * @param[in] anchor The anchor of the kernel, (-1,-1) for the center.
+     */
+    void setKernel(const cv::Mat& kernel, cv::Point anchor = cv::Point(-1, -1));
+
+    /**
+     * @brief Whether the given kernel is the one already in use.
+     */
+    bool sameKernel(const cv::Mat& kernel) const;
+
+    /**
+     * @brief Whether this is expected to be faster than cv::morphologyEx.
+     *
+     * OpenCV is hard to beat with tiny kernels, so they should still be
+     * given to cv::morphologyEx.
+     */
+    bool preferred() const { return isPreferred; }
+
+    /**
+     * @brief Erodes a binary mask.
+     *
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void erode(const cv::Mat& src, cv::Mat& dst);
+
+    /**
+     * @brief Dilates a binary mask.
+     *
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void dilate(const cv::Mat& src, cv::Mat& dst);
+
+    /**
+     * @brief Applies a morphological operation to a binary mask.
+     *
+     * @param[in] op The operation, one of cv::MORPH_ERODE, cv::MORPH_DILATE, cv::MORPH_OPEN, or cv::MORPH_CLOSE.
+     * @param[in] src The input mask.
+     * @param[out] dst The output mask (may be the same as the input).
+     */
+    void apply(int op, const cv::Mat& src, cv::Mat& dst);
+
+  private:
+    /**
+     * @brief A horizontal run of ones in the kernel, relative to the anchor.
+     */
+    struct Chord {
+      int dx; /**< The horizontal offset of the start of the chord. */
+      int dy; /**< The vertical offset of the chord. */
+      int length; /**< The number of kernel elements in the chord. */
+    };
+
+    template<bool Erode> void rectMorphology(const cv::Mat& src, cv::Mat& dst);
+    template<bool Erode> void chordMorphology(const cv::Mat& src, cv::Mat& dst);
+
+    cv::Mat kernel;
+    cv::Point anchor;
+    bool isRect = true, isPreferred = false;
+    std::vector<Chord> chords;
+
+    // Buffers reused between calls.
+    cv::Mat horizontal, prefix, suffix, runs, between;
+    std::vector<uchar> line, linePrefix, lineSuffix, borderRow;
+  };
+}
@@ -0,0 +1,199 @@
+/**
+ * @file regionProcessing.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Functions and classes to only proccess regions of interest in an image.
+ * @version 0.1
+ * @date 2021-02-08
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "rambunctionVision/imageProcessing.hpp"
+#include "rambunctionVision/contourProcessing.hpp"
+#include "rambunctionVision/blobProcessing.hpp"
+#include "rambunctionVision/contourArena.hpp"
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief Merges any overlapping rectangles into thier bounding rectangle.
+   *
+   * Merging is repeated until none of the rectangles overlap, so each pixel
+   * is in at most one of them.
+   *
+   * @param[in,out] regions The rectangles to be merged.
+   */
+  void mergeRegions(std::vector<cv::Rect>& regions);
+
+  /**
+   * @brief Finds the image space bounding box of each ball.
+   *
+   * @param[in] poses The balls found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each ball's circle.
+   *
+   * @see RegionSearch
+   */
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::BallPose>& poses);
+
+  /**
+   * @brief Finds the image space bounding box of each target.
+   *
+   * @param[in] poses The targets found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each target's contour.
+   *
+   * @see RegionSearch
+   */
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::TargetPose>& poses);
+
+  /**
+   * @brief Finds the image space bounding box of each circle.
+   *
+   * @param[in] circles The circles found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each circle.
+   *
+   * @see RegionSearch findCircles
+   */
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::IndexedCircleMatch>& circles);
+
+  /**
+   * @brief Finds the image space bounding box of each matched target.
+   *
+   * @param[in] contours The contours the matches refer to.
+   * @param[in] matches The targets found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each match's contour.
+   *
+   * @see RegionSearch findTargets
+   */
+  std::vector<cv::Rect> boundingRects(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the image space bounding box of each matched target.
+   *
+   * @param[in] contours The contours the matches refer to.
+   * @param[in] matches The targets found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each match's contour.
+   *
+   * @see RegionSearch findTargets ContourArena
+   */
+  std::vector<cv::Rect> boundingRects(const rv::ContourArena& contours, const std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the image space bounding box of each matched target from its contour's features.
+   *
+   * @param[in,out] features The features of the contours the matches refer to.
+   * @param[in] matches The targets found in the last frame.
+   * @return std::vector<cv::Rect> The bounding box of each match's contour.
+   *
+   * @see RegionSearch findTargets ContourFeatures
+   */
+  std::vector<cv::Rect> boundingRects(std::vector<rv::ContourFeatures>& features, const std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Thresholds and searches for contours only around previous detections.
+   *
+   * After a frame is processed, the bounding boxes of what was found are
+   * given to update. The next frame is then only thresheld and searched for
+   * contours in padded windows around them. The full frame is searched again
+   * when nothing was found in the last frame, or every `rescanInterval`
+   * frames to pick up new objects. Contours are always given in full frame
+   * coordinates, so they can be used just like ones from cv::findContours.
+   *
+   * With pyramid levels, full frame searches are done coarse to fine. The
+   * frame is first shrunk by a factor of 2 per level and thresheld with a
+   * threshold scaled to match. The padded bounding box of each contour in
+   * the small mask is then searched again at full resolution, so contours
+   * still have full resolution accuracy.
+   *
+   * @see ThresholdContext boundingRects
+   */
+  class RegionSearch {
+  public:
+    /**
+     * @brief Creates a region search.
+     *
+     * @param[in] frameSize The size of the camera frames.
+     * @param[in] method How to blur, convert and threshold the image (see ThresholdMethods).
+     * @param[in] rescanInterval Frames between full frame searches (0 always searches the full frame).
+     * @param[in] padding Pixels added to each side of a previous detection.
+     * @param[in] pyramidLevels Times to halve the frame for full frame searches (0 searches at full resolution), clamped to 0-2.
+     */
+    RegionSearch(cv::Size frameSize, int method = THRESHOLD_LEGACY, int rescanInterval = 0, int padding = 32, int pyramidLevels = 0);
+
+    /**
+     * @brief Thresholds the regions of the frame to be searched.
+     *
+     * Only the parts of the mask inside the regions being searched are
+     * written, the rest is left as it was.
+     *
+     * @param[in] frame The input camera frame.
+     * @param[out] mask The full frame sized output mask.
+     * @param[in] threshold The parameters to threshold the image by.
+     */
+    void threshold(const cv::Mat& frame, cv::Mat& mask, const rv::Threshold& threshold);
+
+    /**
+     * @brief Finds the external contours in the regions being searched.
+     *
+     * @param[in] mask The mask given by threshold.
+     * @param[out] contours The contours in full frame coordinates.
+     */
+    void findContours(const cv::Mat& mask, std::vector<std::vector<cv::Point>>& contours);
+
+    /**
+     * @brief Finds the external contours in the regions being searched without allocating.
+     *
+     * @param[in] mask The mask given by threshold.
+     * @param[out] contours The contours in full frame coordinates, stored the way the arena's method says.
+     */
+    void findContours(const cv::Mat& mask, rv::ContourArena& contours);
+
+    /**
+     * @brief Finds the connected blobs in the regions being searched.
+     *
+     * @param[in] mask The mask given by threshold.
+     * @param[out] blobs The blobs in full frame coordinates.
+     */
+    void findBlobs(const cv::Mat& mask, std::vector<rv::Blob>& blobs);
+
+    /**
+     * @brief Gives the bounding boxes of what was found in the current frame.
+     *
+     * @param[in] detections The image space bounding boxes of each detection.
+     */
+    void update(const std::vector<cv::Rect>& detections);
+
+    /**
+     * @brief The regions being searched in the current frame.
+     */
+    const std::vector<cv::Rect>& regions() const { return searchRegions; }
+
+    rv::ThresholdContext context; /**< Buffers used to threshold each region. */
+    int rescanInterval; /**< Frames between full frame searches (0 always searches the full frame). */
+    int padding; /**< Pixels added to each side of a previous detection. */
+    int pyramidLevels; /**< Times to halve the frame for full frame searches (0 searches at full resolution), clamped to 0-2 when used. */
+
+  private:
+    void coarseSearch(const cv::Mat& frame, const rv::Threshold& threshold);
+
+    std::vector<cv::Rect> detections, searchRegions;
+    std::vector<std::vector<cv::Point>> regionContours;
+    rv::ContourArena coarseContours{cv::CHAIN_APPROX_SIMPLE};
+    std::vector<rv::Blob> regionBlobs;
+    rv::BlobFinder blobFinder;
+    int framesSinceScan = 0;
+
+    // Used for the coarse search of the shrunken frame.
+    rv::ThresholdContext coarseContext;
+    rv::Threshold coarseThreshold;
+    cv::Mat coarseFrame, coarseMask;
+  };
+}
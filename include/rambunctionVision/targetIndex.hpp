@@ -0,0 +1,137 @@
+/**
+ * @file targetIndex.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief An index to quickly find the target best matching a contour.
+ * @version 0.1
+ * @date 2021-02-14
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "rambunctionVision/contourProcessing.hpp"
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief A KD-tree over the Hu moments of a library of targets.
+   *
+   * Targets are compared the same way as cv::CONTOURS_MATCH_I1, which skips
+   * any moment too small to compare on either shape. Targets are grouped by
+   * which of thier moments can be compared, and each group gets its own
+   * tree, so the bounding box of a node always gives a true lower bound on
+   * how well anything in it can match. Whole branches are skipped once they
+   * can't beat the best match so far, so the cost grows far slower than the
+   * number of targets. The result is the same as checking every target.
+   *
+   * The index keeps its own copy of the moments, so it has to be built
+   * again if the targets change.
+   *
+   * @see Target HuMoments findTargets
+   */
+  class TargetIndex {
+  public:
+    TargetIndex() = default;
+
+    /**
+     * @brief Builds the index for a list of targets.
+     *
+     * @param[in] targets The targets to index.
+     */
+    explicit TargetIndex(const std::vector<rv::Target>& targets) { build(targets); }
+
+    /**
+     * @brief Builds the index for a list of targets.
+     *
+     * @param[in] targets The targets to index, using thier cached moments when up to date.
+     */
+    void build(const std::vector<rv::Target>& targets);
+
+    /**
+     * @brief Finds the target best matching a shape.
+     *
+     * @param[in] moments The moments of the shape.
+     * @param[in] maxMatch The match value a target must be below (lower is better).
+     * @param[out] match The match value of the best target.
+     * @return int The index of the best target, or -1 if none are below maxMatch.
+     */
+    int nearest(const rv::HuMoments& moments, double maxMatch, double& match) const;
+
+    bool empty() const { return moments.empty(); } /**< Whether there are no targets in the index. */
+    int size() const { return moments.size(); } /**< The number of targets in the index. */
+
+  private:
+    /**
+     * @brief A box around a range of targets, split in two unless it's a leaf.
+     */
+    struct Node {
+      cv::Vec<double, 7> low, high; /**< The bounds of the targets' moments. */
+      int start, end; /**< The range of `order` holding the node's targets. */
+      int left = -1, right = -1; /**< The children of the node, -1 for a leaf. */
+    };
+
+    /**
+     * @brief The tree of targets which have the same moments that can be compared.
+     */
+    struct Group {
+      int mask; /**< Bit i is set when moment i can be compared. */
+      std::vector<Node> nodes; /**< The nodes of the tree, the first is the root. */
+    };
+
+    int buildNode(rv::TargetIndex::Group& group, int start, int end);
+
+    std::vector<rv::HuMoments> moments;
+    std::vector<int> order;
+    std::vector<Group> groups;
+  };
+
+  /**
+   * @brief Finds the targets that best matches each contour using an index.
+   *
+   * The same as findTargets, but each contour is looked up in the index
+   * rather than compared with every target.
+   *
+   * @param[in] contours The input contours to be matched.
+   * @param[in] index The index built from the targets.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   *
+   * @see TargetIndex IndexedTargetMatch
+   */
+  void findTargets(const std::vector<std::vector<cv::Point>>& contours, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the targets that best matches each contour in an arena using an index.
+   *
+   * @param[in] contours The input contours to be matched.
+   * @param[in] index The index built from the targets.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   *
+   * @see ContourArena TargetIndex
+   */
+  void findTargets(const rv::ContourArena& contours, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+
+  /**
+   * @brief Finds the targets that best matches each contour using thier features and an index.
+   *
+   * @param[in,out] features The features of the contours to be matched.
+   * @param[in] index The index built from the targets.
+   * @param[in] minArea The minimum contour area allowable.
+   * @param[in] maxMatch The mamatch value allowable (lower is better).
+   * @param[out] matches The indices of the paired up contours and targets.
+   *
+   * @see ContourFeatures TargetIndex
+   */
+  void findTargets(std::vector<rv::ContourFeatures>& features, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+}
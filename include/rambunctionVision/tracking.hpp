@@ -0,0 +1,201 @@
+/**
+ * @file tracking.hpp
+ * @author George Jurgiel (gcjurgiel@icloud.com)
+ * @brief Follows objects between frames so they keep the same id.
+ * @version 0.1
+ * @date 2021-02-20
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "rambunctionVision/contourProcessing.hpp"
+#include "rambunctionVision/targetIndex.hpp"
+
+/**
+ * @brief 'Rambunction Vision' namespace to store shared code.
+ */
+namespace rv {
+
+  /**
+   * @brief An object followed between frames.
+   *
+   * @see Tracker
+   */
+  struct Track {
+    int id; /**< The id of the object, which stays the same while it's tracked. */
+    cv::Point3d position; /**< The smoothed position of the object. */
+    cv::Point3d velocity; /**< The estimated velocity of the object, per second. */
+    cv::Point3d predicted; /**< Where the object is expected to be next frame. */
+    cv::Rect bounds; /**< The image space bounding box of the object when it was last seen. */
+    int detection; /**< The index of the detection matched to it this frame, or -1 if it was missed. */
+    int hits; /**< The number of frames the object has been seen in. */
+    int misses; /**< The number of frames since the object was last seen. */
+    bool confirmed; /**< Whether the object has been seen enough times to be reported. */
+    cv::KalmanFilter filter; /**< A constant velocity filter over the position and velocity. */
+
+    /**
+     * @brief Where the object is expected to be some time after this frame.
+     *
+     * @param[in] dt The seconds after this frame, for example the time since it was captured.
+     * @return cv::Point3d The position moved along the velocity.
+     */
+    cv::Point3d at(double dt) const { return position + velocity * dt; }
+  };
+
+  /**
+   * @brief Follows objects between frames with a Kalman filter for each one.
+   *
+   * Every frame each track predicts where its object will be, and detections
+   * are matched greedily to the closest prediction within maxDistance. A
+   * matched track is corrected with its detection, a new track is started
+   * for every detection left over, and tracks that are missed for more than
+   * maxMisses frames are dropped. Tracks are only confirmed after minHits
+   * detections, so a single false detection never gets an id reported.
+   *
+   * Tracks keep the image bounding box of thier last detection, so only
+   * the regions around tracked objects need to be searched.
+   *
+   * @see Track RegionSearch
+   */
+  class Tracker {
+  public:
+    /**
+     * @brief Creates a tracker with no tracks.
+     *
+     * @param[in] maxDistance The furthest a detection can be from a track's prediction to be matched to it.
+     * @param[in] maxMisses The number of frames in a row a track can be missed before it's dropped.
+     * @param[in] minHits The number of detections before a track is confirmed.
+     * @param[in] processNoise How much the velocity is expected to change, as the variance of the acceleration.
+     * @param[in] measurementNoise The variance of each detected position.
+     */
+    explicit Tracker(double maxDistance = 12, int maxMisses = 5, int minHits = 3, double processNoise = 100, double measurementNoise = 1)
+      : maxDistance(maxDistance), maxMisses(maxMisses), minHits(minHits), processNoise(processNoise), measurementNoise(measurementNoise) {}
+
+    /**
+     * @brief Matches a frame's detections to the tracks and updates them.
+     *
+     * @param[in] positions The position of each detection.
+     * @param[in] bounds The image space bounding box of each detection.
+     * @param[in] dt The seconds since the last frame.
+     */
+    void update(const std::vector<cv::Point3d>& positions, const std::vector<cv::Rect>& bounds, double dt);
+
+    /**
+     * @brief Removes every track, without reusing thier ids.
+     */
+    void clear() { active.clear(); }
+
+    const std::vector<rv::Track>& tracks() const { return active; } /**< Every track, confirmed or not, oldest first. */
+
+    /**
+     * @brief Finds the regions to search for the tracked objects next frame.
+     *
+     * Tracks missed for a few frames are included, so objects that were
+     * briefly hidden are still searched for.
+     *
+     * @return std::vector<cv::Rect> The bounding box of each track when it was last seen.
+     */
+    std::vector<cv::Rect> regions() const;
+
+    double maxDistance; /**< The furthest a detection can be from a track's prediction to be matched to it. */
+    int maxMisses; /**< The number of frames in a row a track can be missed before it's dropped. */
+    int minHits; /**< The number of detections before a track is confirmed. */
+    double processNoise; /**< How much the velocity is expected to change, as the variance of the acceleration. */
+    double measurementNoise; /**< The variance of each detected position. */
+
+  private:
+    /**
+     * @brief A detection close enough to a track's prediction to be matched to it.
+     */
+    struct Candidate {
+      double distance; /**< The distance from the prediction to the detection. */
+      int track; /**< The index of the track. */
+      int detection; /**< The index of the detection. */
+    };
+
+    void startTrack(const cv::Point3d& position, const cv::Rect& bounds, int detection);
+
+    std::vector<rv::Track> active;
+    int nextId = 0;
+
+    // Buffers reused between frames.
+    std::vector<Candidate> candidates;
+    std::vector<char> used;
+  };
+
+  /**
+   * @brief Finds targets, reusing last frame's matches for contours that barely moved.
+   *
+   * Finding a target's points means normalizing the contour, comparing
+   * orientations and approximating it to the target's number of sides,
+   * which is wasted on a target that was found in the same place last
+   * frame. A contour whose bounding box overlaps a match from last frame
+   * (by intersection over union), and whose Hu moments are still within
+   * maxMatch of that match's target, takes that target, and each of its
+   * image points is moved by how far the box moved and snapped to the
+   * closest point of the contour. Only contours that overlap nothing, no
+   * longer look like the target, or whose points move too far when snapped
+   * or no longer make the same polygon (two on the same contour point, out
+   * of order along the contour, or turned inside out), go through
+   * findTargets and matchTargetPoints.
+   *
+   * @see findTargets matchTargetPoints TargetIndex
+   */
+  class TargetCache {
+  public:
+    /**
+     * @brief Creates an empty cache.
+     *
+     * @param[in] minOverlap The intersection over union a contour needs with a previous match to reuse it.
+     * @param[in] maxSnap The furthest a point can move when snapped to the contour, as a fraction of the contour's size.
+     */
+    explicit TargetCache(double minOverlap = 0.5, double maxSnap = 0.1) : minOverlap(minOverlap), maxSnap(maxSnap) {}
+
+    /**
+     * @brief Finds the targets and thier image points, reusing last frame's where possible.
+     *
+     * @param[in,out] features The features of the contours to be matched.
+     * @param[in] targets The targets the index was built from.
+     * @param[in] index The index built from the targets.
+     * @param[in] minArea The minimum contour area allowable.
+     * @param[in] maxMatch The maximum Hu moment match value allowable, for new and reused contours (lower is better).
+     * @param[out] matches The matches with thier image points, in order of contour. A reused match's value is its Hu moment match from this frame.
+     */
+    void find(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches);
+
+    /**
+     * @brief Forgets every match, so the next frame is matched from scratch.
+     */
+    void clear() { previous.clear(); }
+
+    int reused() const { return reusedCount; } /**< The number of matches reused in the last frame. */
+
+    double minOverlap; /**< The intersection over union a contour needs with a previous match to reuse it. */
+    double maxSnap; /**< The furthest a point can move when snapped to the contour, as a fraction of the contour's size. */
+
+  private:
+    /**
+     * @brief A match from last frame.
+     */
+    struct Entry {
+      cv::Rect bounds; /**< The bounding box of the contour. */
+      int target; /**< The index of the target. */
+      std::vector<cv::Point2f> imagePoints; /**< The image points in the same order as the target's shape. */
+    };
+
+    std::vector<Entry> previous;
+    int reusedCount = 0;
+
+    // Buffers reused between frames.
+    std::vector<char> claimed;
+    std::vector<int> snappedIndices;
+    std::vector<rv::IndexedTargetMatch> fresh;
+  };
+}
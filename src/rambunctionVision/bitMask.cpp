@@ -0,0 +1,289 @@
+#include "rambunctionVision/bitMask.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+  // Combines two words of pixels for either an erosion (and) or dilation (or).
+  template<bool Erode>
+  inline std::uint64_t combine(std::uint64_t a, std::uint64_t b) {
+    return Erode ? (a & b) : (a | b);
+  }
+
+  // The word of pixels that never changes the result when combined.
+  template<bool Erode>
+  inline std::uint64_t identity() {
+    return Erode ? ~std::uint64_t(0) : 0;
+  }
+
+  // The 64 bits of a row starting at bit `pos`. Words past the end
+  // of the row are filled with the identity.
+  template<bool Erode>
+  inline std::uint64_t wordAt(const std::uint64_t* row, int length, int pos) {
+    int word = pos >> 6, bit = pos & 63;
+    std::uint64_t low = word < length ? row[word] : identity<Erode>();
+    if (bit == 0) {
+      return low;
+    }
+    std::uint64_t high = word + 1 < length ? row[word + 1] : identity<Erode>();
+    return (low >> bit) | (high << (64 - bit));
+  }
+
+  inline int popcount(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(word);
+#else
+    int count = 0;
+    for (; word; count++) {
+      word &= word - 1;
+    }
+    return count;
+#endif
+  }
+}
+
+namespace rv {
+  void BitMask::create(cv::Size size) {
+    rows = size.height;
+    cols = size.width;
+    stride = (cols + 63) / 64;
+    words.assign(static_cast<std::size_t>(rows) * stride, 0);
+  }
+
+  void BitMask::fromMat(const cv::Mat& mask) {
+    CV_Assert(mask.type() == CV_8UC1);
+    create(mask.size());
+
+    for (int y = 0; y < rows; y++) {
+      const uchar* in = mask.ptr<uchar>(y);
+      std::uint64_t* out = row(y);
+
+      for (int i = 0; i < stride; i++) {
+        const uchar* pixels = in + i * 64;
+        const int count = std::min(64, cols - i * 64);
+
+        std::uint64_t word = 0;
+        for (int b = 0; b < count; b++) {
+          word |= std::uint64_t(pixels[b] != 0) << b;
+        }
+        out[i] = word;
+      }
+    }
+  }
+
+  void BitMask::toMat(cv::Mat& mask) const {
+    mask.create(size(), CV_8UC1);
+
+    for (int y = 0; y < rows; y++) {
+      const std::uint64_t* in = row(y);
+      uchar* out = mask.ptr<uchar>(y);
+
+      for (int x = 0; x < cols; x++) {
+        out[x] = ((in[x >> 6] >> (x & 63)) & 1) ? 255 : 0;
+      }
+    }
+  }
+
+  int BitMask::area() const {
+    int count = 0;
+    for (auto word : words) {
+      count += popcount(word);
+    }
+    return count;
+  }
+
+  void BitMorphology::setKernel(const cv::Mat& newKernel, cv::Point newAnchor) {
+    // Like OpenCV, an empty kernel means a 3x3 rectangle.
+    cv::Mat kernel;
+    if (newKernel.empty()) {
+      kernel = cv::Mat(3, 3, CV_8UC1, cv::Scalar(1));
+    } else {
+      newKernel.convertTo(kernel, CV_8U);
+    }
+
+    kernelSize = kernel.size();
+    anchor.x = newAnchor.x < 0 ? kernel.cols / 2 : newAnchor.x;
+    anchor.y = newAnchor.y < 0 ? kernel.rows / 2 : newAnchor.y;
+
+    // Break each row of the kernel into runs of ones, and
+    // keep track of each diffrent run length.
+    chords.clear();
+    lengths.clear();
+    int elements = 0;
+    for (int y = 0; y < kernel.rows; y++) {
+      const uchar* row = kernel.ptr<uchar>(y);
+      for (int x = 0; x < kernel.cols; x++) {
+        if (!row[x]) {
+          continue;
+        }
+
+        int start = x;
+        while (x < kernel.cols && row[x]) {
+          x++;
+        }
+
+        int length = x - start;
+        auto found = std::find(lengths.begin(), lengths.end(), length);
+        if (found == lengths.end()) {
+          found = lengths.insert(lengths.end(), length);
+        }
+        chords.push_back({start - anchor.x, y - anchor.y, static_cast<int>(found - lengths.begin())});
+        elements += length;
+      }
+    }
+
+    isRect = elements == kernel.rows * kernel.cols;
+  }
+
+  void BitMorphology::erode(const rv::BitMask& src, rv::BitMask& dst) {
+    morphology<true>(src, dst);
+  }
+
+  void BitMorphology::dilate(const rv::BitMask& src, rv::BitMask& dst) {
+    morphology<false>(src, dst);
+  }
+
+  void BitMorphology::apply(int op, const rv::BitMask& src, rv::BitMask& dst) {
+    switch (op) {
+      case cv::MORPH_ERODE:
+        erode(src, dst);
+        break;
+      case cv::MORPH_DILATE:
+        dilate(src, dst);
+        break;
+      case cv::MORPH_OPEN:
+        erode(src, between);
+        dilate(between, dst);
+        break;
+      case cv::MORPH_CLOSE:
+        dilate(src, between);
+        erode(between, dst);
+        break;
+      default:
+        CV_Assert(false && "Unsupported morphology operation");
+    }
+  }
+
+  template<bool Erode>
+  void BitMorphology::morphology(const rv::BitMask& src, rv::BitMask& dst) {
+    const int rows = src.size().height;
+    const int stride = src.step();
+    const std::uint64_t lastBits = src.lastWordBits();
+
+    // Each row is padded with enough words of the identity on both
+    // sides that any chord can be shifted without leaving the row.
+    const int margin = (kernelSize.width + 63) / 64 + 1;
+    const int padded = stride + 2 * margin;
+    runs.resize(lengths.size() * static_cast<std::size_t>(rows) * padded);
+
+    auto runRow = [&](int length, int y) {
+      return runs.data() + (static_cast<std::size_t>(length) * rows + y) * padded;
+    };
+
+    // For each chord length, find where a run of that many pixels starts.
+    // A run of n pixels is found by combining a row with itself shifted by
+    // 1, 2, 4, ... pixels, and then once more for the remainder.
+    for (int l = 0; l < lengths.size(); l++) {
+      for (int y = 0; y < rows; y++) {
+        std::uint64_t* run = runRow(l, y);
+        std::fill(run, run + margin, identity<Erode>());
+        std::memcpy(run + margin, src.row(y), stride * sizeof(std::uint64_t));
+        std::fill(run + margin + stride, run + padded, identity<Erode>());
+        if (Erode && stride > 0) {
+          run[margin + stride - 1] |= ~lastBits;
+        }
+
+        // Each word only reads itself and the words after it, so
+        // going forward the run can be updated in place.
+        auto extend = [&](int shift) {
+          for (int i = 0; i < padded; i++) {
+            run[i] = combine<Erode>(run[i], wordAt<Erode>(run, padded, i * 64 + shift));
+          }
+        };
+
+        int have = 1;
+        for (; have * 2 <= lengths[l]; have *= 2) {
+          extend(have);
+        }
+        if (have < lengths[l]) {
+          extend(lengths[l] - have);
+        }
+      }
+    }
+
+    dst.create(src.size());
+
+    if (isRect && !chords.empty()) {
+      // Every row of the kernel is the same chord, so the rows are
+      // combined the same way the pixels were.
+      const int height = kernelSize.height;
+      const int dx = chords[0].dx;
+      const int total = rows + height - 1;
+      vertical.resize(static_cast<std::size_t>(total) * stride);
+
+      for (int v = 0; v < total; v++) {
+        std::uint64_t* out = vertical.data() + static_cast<std::size_t>(v) * stride;
+        int y = v - anchor.y;
+        if (y < 0 || y >= rows) {
+          std::fill(out, out + stride, identity<Erode>());
+          continue;
+        }
+
+        const std::uint64_t* run = runRow(0, y);
+        for (int i = 0; i < stride; i++) {
+          out[i] = wordAt<Erode>(run, padded, (margin + i) * 64 + dx);
+        }
+      }
+
+      int have = 1;
+      for (; have * 2 <= height; have *= 2) {
+        for (int v = 0; v + have < total; v++) {
+          std::uint64_t* out = vertical.data() + static_cast<std::size_t>(v) * stride;
+          const std::uint64_t* next = out + static_cast<std::size_t>(have) * stride;
+          for (int i = 0; i < stride; i++) {
+            out[i] = combine<Erode>(out[i], next[i]);
+          }
+        }
+      }
+
+      for (int y = 0; y < rows; y++) {
+        const std::uint64_t* top = vertical.data() + static_cast<std::size_t>(y) * stride;
+        const std::uint64_t* bottom = vertical.data() + static_cast<std::size_t>(y + height - have) * stride;
+        std::uint64_t* out = dst.row(y);
+        for (int i = 0; i < stride; i++) {
+          out[i] = combine<Erode>(top[i], bottom[i]);
+        }
+      }
+    } else {
+      for (int y = 0; y < rows; y++) {
+        std::uint64_t* out = dst.row(y);
+        std::fill(out, out + stride, identity<Erode>());
+
+        for (auto& chord : chords) {
+          // Chords falling outside the mask are ignored.
+          int row = y + chord.dy;
+          if (row < 0 || row >= rows) {
+            continue;
+          }
+
+          const std::uint64_t* run = runRow(chord.run, row);
+          for (int i = 0; i < stride; i++) {
+            out[i] = combine<Erode>(out[i], wordAt<Erode>(run, padded, (margin + i) * 64 + chord.dx));
+          }
+        }
+      }
+    }
+
+    // Keep the bits past the last column clear.
+    if (stride > 0) {
+      for (int y = 0; y < rows; y++) {
+        dst.row(y)[stride - 1] &= lastBits;
+      }
+    }
+  }
+}
@@ -0,0 +1,177 @@
+#include "rambunctionVision/blobProcessing.hpp"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+
+namespace {
+  // The sum of squares 0^2 + 1^2 + ... + k^2.
+  inline double sumOfSquares(double k) {
+    return k * (k + 1) * (2 * k + 1) / 6;
+  }
+}
+
+namespace rv {
+  int BlobFinder::root(int label) {
+    while (parents[label] != label) {
+      // Point each label on the way at its grandparent to keep the trees flat.
+      parents[label] = parents[parents[label]];
+      label = parents[label];
+    }
+    return label;
+  }
+
+  void BlobFinder::join(int a, int b) {
+    a = root(a);
+    b = root(b);
+    if (a == b) {
+      return;
+    }
+
+    // The older label is kept so blobs come out in scan order.
+    if (a > b) {
+      std::swap(a, b);
+    }
+    parents[b] = a;
+
+    Sums& to = sums[a];
+    const Sums& from = sums[b];
+    to.m00 += from.m00;
+    to.m10 += from.m10;
+    to.m01 += from.m01;
+    to.m20 += from.m20;
+    to.m11 += from.m11;
+    to.m02 += from.m02;
+    to.minX = std::min(to.minX, from.minX);
+    to.minY = std::min(to.minY, from.minY);
+    to.maxX = std::max(to.maxX, from.maxX);
+    to.maxY = std::max(to.maxY, from.maxY);
+  }
+
+  void BlobFinder::find(const cv::Mat& mask, std::vector<rv::Blob>& blobs, cv::Point offset) {
+    CV_Assert(mask.type() == CV_8UC1);
+    blobs.clear();
+    previous.clear();
+    parents.clear();
+    sums.clear();
+
+    for (int y = 0; y < mask.rows; y++) {
+      const uchar* row = mask.ptr<uchar>(y);
+      current.clear();
+
+      // Break the row into runs, each starting as its own blob.
+      int x = 0;
+      while (x < mask.cols) {
+        while (x < mask.cols && !row[x]) {
+          x++;
+        }
+        if (x == mask.cols) {
+          break;
+        }
+
+        int start = x;
+        while (x < mask.cols && row[x]) {
+          x++;
+        }
+
+        // The moments of a run are all found in closed form.
+        double n = x - start;
+        double sumX = n * (start + x - 1) / 2;
+        double sumXX = sumOfSquares(x - 1) - sumOfSquares(start - 1);
+
+        int label = parents.size();
+        parents.push_back(label);
+        sums.push_back({n, sumX, n * y, sumXX, sumX * y, n * y * y, start, y, x - 1, y});
+        current.push_back({start, x, label});
+      }
+
+      // Join each run with the runs it touches in the row above, including
+      // diagonally. Both rows are sorted, so runs that end before this one
+      // can't touch any of the later runs either.
+      int first = 0;
+      for (auto& run : current) {
+        while (first < previous.size() && previous[first].end < run.start) {
+          first++;
+        }
+        for (int i = first; i < previous.size() && previous[i].start <= run.end; i++) {
+          join(run.label, previous[i].label);
+        }
+      }
+
+      std::swap(previous, current);
+    }
+
+    // Every label that is still its own root is a whole blob.
+    for (int label = 0; label < parents.size(); label++) {
+      if (parents[label] != label) {
+        continue;
+      }
+
+      const Sums& sum = sums[label];
+      rv::Blob blob;
+      blob.area = static_cast<int>(sum.m00);
+      blob.boundingBox = cv::Rect(sum.minX + offset.x, sum.minY + offset.y, sum.maxX - sum.minX + 1, sum.maxY - sum.minY + 1);
+
+      double cx = sum.m10 / sum.m00;
+      double cy = sum.m01 / sum.m00;
+      blob.centroid = cv::Point2d(cx + offset.x, cy + offset.y);
+      blob.varianceX = sum.m20 / sum.m00 - cx * cx;
+      blob.covariance = sum.m11 / sum.m00 - cx * cy;
+      blob.varianceY = sum.m02 / sum.m00 - cy * cy;
+
+      blobs.push_back(blob);
+    }
+  }
+
+  std::vector<rv::CircleMatch> findCircles(const std::vector<rv::Blob>& blobs, double minArea, double minMatch) {
+    std::vector<rv::IndexedCircleMatch> indexed;
+    findCircles(blobs, minArea, minMatch, indexed);
+
+    std::vector<rv::CircleMatch> matches;
+    for (auto& match : indexed) {
+      matches.push_back({std::vector<cv::Point>(), match.circle, match.match});
+    }
+    return matches;
+  }
+
+  void findCircles(const std::vector<rv::Blob>& blobs, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches) {
+    matches.assign(blobs.size(), {-1, rv::Circle(), 0});
+    rv::parallelForEach(blobs.size(), [&](int i) {
+      const rv::Blob& blob = blobs[i];
+
+      // Cheak if the blob is too small to consider
+      if (blob.area < minArea) {
+        return;
+      }
+
+      // Principal axes of the blob. Pixel centers have 1/12 less variance
+      // than the area they cover, so that is added back first.
+      double mean = (blob.varianceX + blob.varianceY) / 2 + 1.0 / 12;
+      double spread = std::sqrt(std::pow((blob.varianceX - blob.varianceY) / 2, 2) + blob.covariance * blob.covariance);
+      double major = mean + spread;
+      double minor = std::max(mean - spread, 0.0);
+
+      // A solid disc of radius r has a variance of r^2/4 along any axis.
+      rv::Circle circle;
+      circle.center = blob.centroid;
+      circle.radius = 2 * std::sqrt(major);
+
+      // How round it is, times how much it fills the ellipse with the same
+      // moments. A solid circle scores 1, rings and slivers score lower.
+      double roundness = std::sqrt(minor / major);
+      double fill = std::min(blob.area / (4 * M_PI * std::sqrt(major * minor)), 1.0);
+      double matchValue = minor > 0 ? roundness * fill : 0;
+
+      // If the match is sufficent,
+      if (matchValue > minMatch) {
+        matches[i] = {i, circle, matchValue};
+      }
+    });
+
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [](const rv::IndexedCircleMatch& match) {
+      return match.contour < 0;
+    }), matches.end());
+  }
+}
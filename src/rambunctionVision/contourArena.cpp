@@ -0,0 +1,212 @@
+#include "rambunctionVision/contourArena.hpp"
+
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+  // The 8 neighbors of a pixel as (row, col) offsets, going counter-clockwise
+  // starting from the right. Opposite directions are 4 apart.
+  const int rowOffsets[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+  const int colOffsets[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+  // The sign of a number (-1, 0 or 1).
+  inline int sign(int value) {
+    return (value > 0) - (value < 0);
+  }
+
+  // Removes the points in the middle of straight horizontal, vertical
+  // and diagonal runs, like cv::CHAIN_APPROX_SIMPLE. The first point
+  // is always kept. Returns the new number of points.
+  int compressChain(cv::Point* points, int length) {
+    if (length < 3) {
+      return length;
+    }
+
+    const cv::Point first = points[0];
+    cv::Point previous = points[length - 1];
+    int kept = 0;
+    for (int i = 0; i < length; i++) {
+      const cv::Point current = points[i];
+      const cv::Point next = i + 1 < length ? points[i + 1] : first;
+
+      cv::Point in(sign(current.x - previous.x), sign(current.y - previous.y));
+      cv::Point out(sign(next.x - current.x), sign(next.y - current.y));
+      if (i == 0 || in != out) {
+        points[kept++] = current;
+      }
+      previous = current;
+    }
+    return kept;
+  }
+}
+
+namespace rv {
+  void ContourArena::add(const cv::Mat& mask, cv::Point offset) {
+    CV_Assert(mask.type() == CV_8UC1);
+
+    // Labels of each pixel, with a border of background so borders can
+    // be followed without checking the edges of the image. 0 is the
+    // background and 1 is a pixel that isn't on a traced border yet.
+    // The buffer is kept at the largest size seen, so masks from regions
+    // of diffrent sizes are labeled in a view of it instead of each
+    // reallocating it.
+    if (labelBuffer.rows < mask.rows + 2 || labelBuffer.cols < mask.cols + 2) {
+      labelBuffer.create(std::max(labelBuffer.rows, mask.rows + 2), std::max(labelBuffer.cols, mask.cols + 2), CV_32SC1);
+    }
+    labels = labelBuffer(cv::Rect(0, 0, mask.cols + 2, mask.rows + 2));
+    labels.row(0).setTo(0);
+    labels.row(labels.rows - 1).setTo(0);
+    for (int y = 0; y < mask.rows; y++) {
+      const uchar* in = mask.ptr<uchar>(y);
+      int* out = labels.ptr<int>(y + 1);
+      out[0] = 0;
+      out[mask.cols + 1] = 0;
+      for (int x = 0; x < mask.cols; x++) {
+        out[x + 1] = in[x] != 0;
+      }
+    }
+
+    // Label 1 is the frame around the image, which counts as a hole.
+    parents.assign(2, 0);
+    holes.assign(2, true);
+    int label = 1;
+
+    for (int row = 1; row <= mask.rows; row++) {
+      int* pixels = labels.ptr<int>(row);
+
+      // The label of the last border passed in this row.
+      int lastLabel = 1;
+
+      for (int col = 1; col <= mask.cols; col++) {
+        int value = pixels[col];
+        if (value == 0) {
+          continue;
+        }
+
+        // The pixel starts a new outer border if it's the first set pixel
+        // after the background, or a new hole border if it's the last set
+        // pixel before the background and not already on a border.
+        bool outer = value == 1 && pixels[col - 1] == 0;
+        bool hole = !outer && value >= 1 && pixels[col + 1] == 0;
+
+        if (outer || hole) {
+          label++;
+          if (hole && value > 1) {
+            lastLabel = value;
+          }
+
+          // A border of the same kind as the last one passed shares its
+          // parent, otherwise it's inside the last one.
+          int parent = outer != holes[lastLabel] ? parents[lastLabel] : lastLabel;
+          parents.push_back(parent);
+          holes.push_back(hole);
+
+          // Only the outer borders of shapes not inside any other are kept.
+          bool keep = outer && parent == 1;
+          int start = points.size();
+          trace(row, col, outer ? 4 : 0, label, keep, offset - cv::Point(1, 1));
+
+          if (keep) {
+            int length = points.size() - start;
+            if (method == cv::CHAIN_APPROX_SIMPLE) {
+              length = compressChain(points.data() + start, length);
+              points.resize(start + length);
+            }
+            spans.push_back({start, length});
+          }
+        }
+
+        value = pixels[col];
+        if (value != 1) {
+          lastLabel = std::abs(value);
+        }
+      }
+    }
+  }
+
+  void ContourArena::trace(int row, int col, int from, int label, bool keep, cv::Point offset) {
+    const int step = labels.step1();
+    int* base = labels.ptr<int>(0);
+    int offsets[8];
+    for (int d = 0; d < 8; d++) {
+      offsets[d] = rowOffsets[d] * step + colOffsets[d];
+    }
+
+    const int start = row * step + col;
+
+    // Look clockwise around the first pixel for the next one on the border.
+    int firstDirection = -1;
+    for (int k = 0; k < 8; k++) {
+      int d = (from - k) & 7;
+      if (base[start + offsets[d]] != 0) {
+        firstDirection = d;
+        break;
+      }
+    }
+
+    // A pixel on its own is a border by itself.
+    if (firstDirection < 0) {
+      base[start] = -label;
+      if (keep) {
+        points.push_back(cv::Point(col, row) + offset);
+      }
+      return;
+    }
+
+    const int second = start + offsets[firstDirection];
+    int current = start;
+    int currentRow = row, currentCol = col;
+    int back = firstDirection;
+
+    while (true) {
+      // Look counter-clockwise around the current pixel, starting just
+      // after the one we came from, for the next pixel on the border.
+      int next = back;
+      bool rightIsBackground = false;
+      for (int k = 1; k <= 8; k++) {
+        int d = (back + k) & 7;
+        if (base[current + offsets[d]] != 0) {
+          next = d;
+          break;
+        }
+        if (d == 0) {
+          rightIsBackground = true;
+        }
+      }
+
+      // Pixels with background to the right are labeled negative, so
+      // the raster scan knows it's leaving the border there.
+      if (rightIsBackground) {
+        base[current] = -label;
+      } else if (base[current] == 1) {
+        base[current] = label;
+      }
+
+      if (keep) {
+        points.push_back(cv::Point(currentCol, currentRow) + offset);
+      }
+
+      // Stop when back at the start heading the same way as the first step.
+      const int following = current + offsets[next];
+      if (following == start && current == second) {
+        break;
+      }
+
+      current = following;
+      currentRow += rowOffsets[next];
+      currentCol += colOffsets[next];
+      back = (next + 4) & 7;
+    }
+  }
+
+  void ContourArena::toVectors(std::vector<std::vector<cv::Point>>& contours) const {
+    contours.resize(size());
+    for (int i = 0; i < size(); i++) {
+      contours[i].assign(begin(i), end(i));
+    }
+  }
+}
@@ -1,7 +1,13 @@
 #include <rambunctionVision/contourProcessing.hpp>
 
+#include <cmath>
+#include <atomic>
+#include <cfloat>
 #include <vector>
+#include <numeric>
+#include <functional>
 #include <iostream>
+#include <algorithm>
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -9,76 +15,102 @@
 
 #include "rambunctionVision/conversions.hpp"
 
-namespace rv {
-  std::vector<cv::Point3f> rv::Ball::points() {
-    return std::vector<cv::Point3f> {
-      center,
-      cv::Point3f{radius,  0, 0} + center,
-      cv::Point3f{0, radius,  0} + center,
-      cv::Point3f{-radius, 0, 0} + center,
-      cv::Point3f{0, -radius, 0} + center
-    };
-  }
-
-  double rv::Circle::area() {
-    return radius * radius * M_PI;
+namespace {
+  // How many items a stage needs before it runs in parallel.
+  std::atomic<int> parallelThreshold(8);
+
+  // The distance from a point to the line through two others.
+  double lineDistance(const cv::Point2f& point, const cv::Point2f& a, const cv::Point2f& b) {
+    cv::Point2f line = b - a;
+    double length = std::sqrt(line.dot(line));
+    if (length == 0) {
+      cv::Point2f offset = point - a;
+      return std::sqrt(offset.dot(offset));
+    }
+    return std::abs(line.cross(point - a)) / length;
   }
 
-  std::vector<cv::Point2f> rv::Circle::points() {
-    return std::vector<cv::Point2f> {
-      center,
-      cv::Point2f{radius,  0} + center,
-      cv::Point2f{0,  radius} + center,
-      cv::Point2f{-radius, 0} + center,
-      cv::Point2f{0, -radius} + center
+  // Runs Douglas-Peucker on a closed contour once, finding the largest
+  // error each point would still be kept at. A point is only split on if
+  // the points around it are kept, so its importance is never more than
+  // the point it was split from.
+  void polygonImportance(const std::vector<cv::Point2f>& points, std::vector<double>& importance) {
+    const int size = points.size();
+    importance.assign(size, 0);
+
+    // The contour is first split between the first point and the point
+    // furthest from it. cv::approxPolyDP searches for its own starting
+    // points instead, so the two don't always agree.
+    int far = 0;
+    double farDistance = -1;
+    for (int i = 0; i < size; i++) {
+      cv::Point2f offset = points[i] - points[0];
+      double distance = offset.dot(offset);
+      if (distance > farDistance) {
+        far = i;
+        farDistance = distance;
+      }
+    }
+    importance[0] = DBL_MAX;
+    importance[far] = DBL_MAX;
+
+    // Sections of the contour between two kept points, with the
+    // end wrapping around to the start.
+    struct Section {
+      int start, end;
+      double parent;
     };
-  }
+    std::vector<Section> sections = {{0, far, DBL_MAX}, {far, size, DBL_MAX}};
 
-  bool approximateNGon(std::vector<cv::Point2f>& src, std::vector<cv::Point2f>& dst, int n, double start, double end, double step) {
-    std::vector<cv::Point2f> aprox;
+    while (!sections.empty()) {
+      Section section = sections.back();
+      sections.pop_back();
+      if (section.end - section.start < 2) {
+        continue;
+      }
 
-    // Continually try aproximations with a lower 
-    // accuracy untill it has n sides.
-    for (double epsilon = start; epsilon < end; epsilon += step) {
-      cv::approxPolyDP(src, aprox, epsilon, true);
+      const cv::Point2f& a = points[section.start];
+      const cv::Point2f& b = points[section.end % size];
 
-      // If the approximation has too few sides 
-      // it failed, so return flase.
-      if (aprox.size() < n) {
-        return false;
+      int split = section.start + 1;
+      double splitDistance = -1;
+      for (int i = section.start + 1; i < section.end; i++) {
+        double distance = lineDistance(points[i], a, b);
+        if (distance > splitDistance) {
+          split = i;
+          splitDistance = distance;
+        }
       }
 
-      // If the aproximation  has the corrct number of sides 
-      // return true, and set the output to the aproximation.
-      if (aprox.size() == n) {
-        dst = aprox;
-        return true;
-      }
+      importance[split] = std::min(splitDistance, section.parent);
+      sections.push_back({section.start, split, importance[split]});
+      sections.push_back({split, section.end, importance[split]});
     }
-    // If it gets to the end and no proper aproximation 
-    // has been found, retun false.
-    return false;
   }
 
-  void reorderPoints(std::vector<cv::Point2f>& points) {
+  // The order reorderPoints would put the points in, so that
+  // reordered[i] = points[order[i]].
+  std::vector<int> reorderedIndices(const std::vector<cv::Point2f>& points) {
+    std::vector<int> order(points.size());
+    std::iota(order.begin(), order.end(), 0);
 
     // If the points are counter-clockwise, they will be reversed.
     if (cv::contourArea(points, true) < 0) {
-      std::reverse(points.begin(), points.end());
+      std::reverse(order.begin(), order.end());
     }
 
     // Find the point that is closes to (0,0)
-    auto start = std::min_element(points.begin(), points.end(), [](const cv::Point2f& a, const cv::Point2f& b) {
-      return std::sqrt((a.x * a.x) + (a.y * a.y)) < std::sqrt((b.x * b.x) + (b.y * b.y));
+    auto start = std::min_element(order.begin(), order.end(), [&](int a, int b) {
+      return points[a].dot(points[a]) < points[b].dot(points[b]);
     });
 
-    // Rotate the vector so that the closest point is first
-    std::rotate(points.begin(), start, points.end());
+    // Rotate the order so that the closest point is first
+    std::rotate(order.begin(), start, order.end());
+    return order;
   }
 
-  cv::Mat normalizedContourImage(std::vector<cv::Point2f> contour, std::vector<cv::Point2f>& projectedContour, cv::Mat& image) {
-    // FInd the bounding rotated rect
-    cv::RotatedRect rect = cv::minAreaRect(contour);
+  // The transform projecting a shape's bounding rotated rect onto a 255x255 frame.
+  cv::Mat normalizingTransform(const cv::RotatedRect& rect) {
     cv::Point2f srcPoints[4];
     rect.points(srcPoints);
 
@@ -90,166 +122,839 @@ namespace rv {
       {255, 255}
     };
 
-    // Transform the poins such that the bounding rect
-    // is now the fram of 255 x 255 image.
-    cv::Mat transform = cv::getPerspectiveTransform(srcPoints, dstPoints);
+    return cv::getPerspectiveTransform(srcPoints, dstPoints);
+  }
 
-    // TODO: Fix error here
-    cv::perspectiveTransform(contour, projectedContour, transform);
+  // The moments of projected points about the center of the frame, scaled
+  // so they don't depend on the area or frame size.
+  cv::Vec<double, 9> normalizedMoments(const std::vector<cv::Point2f>& points) {
+    std::vector<cv::Point2f> centered(points.size());
+    std::transform(points.begin(), points.end(), centered.begin(), [](const cv::Point2f& p) {
+      return p - cv::Point2f(128, 128);
+    });
+    cv::Moments m = cv::moments(centered);
 
-    // Draw the points on to the image
-    image = cv::Mat(256, 256, CV_8UC1, cv::Scalar(0));
-    cv::drawContours(image, std::vector<std::vector<cv::Point>>(1, rv::convertToPoints<int>(projectedContour)), 0, 255, -1);
+    if (m.m00 == 0) {
+      return cv::Vec<double, 9>();
+    }
+    const double s1 = m.m00 * 128, s2 = s1 * 128, s3 = s2 * 128;
+    return cv::Vec<double, 9>(m.m10 / s1, m.m01 / s1,
+                              m.m20 / s2, m.m11 / s2, m.m02 / s2,
+                              m.m30 / s3, m.m21 / s3, m.m12 / s3, m.m03 / s3);
+  }
 
-    // Return the matrix used to transform the points.
-    return transform;
+  // The moments of a normalized shape after turning it 90 degrees clockwise
+  // about the center of the frame. A point (u, v) from the center moves to
+  // (-v, u), so each moment m_pq becomes (-1)^p * m_qp.
+  cv::Vec<double, 9> rotateMoments(const cv::Vec<double, 9>& m) {
+    // Moments are ordered m10, m01, m20, m11, m02, m30, m21, m12, m03.
+    return cv::Vec<double, 9>(-m[1], m[0], m[4], -m[3], m[2], -m[8], m[7], -m[6], m[5]);
   }
 
-  std::vector<rv::TargetMatch> matchTargetPoints(std::vector<rv::TargetMatch>& matches) {
-    std::vector<rv::TargetMatch> output;
-    for (auto& match : matches) {
-      cv::Mat shapeImage, targetImage, compareImage;
-      std::vector<cv::Point2f> projectedShape, projectedTarget;
-
-      // Transforms both the target and contour into a 255x255 image
-      cv::Mat shapeTransform = normalizedContourImage(match.shape, projectedShape, shapeImage);
-      cv::Mat targetTransform = normalizedContourImage(match.target.shape, projectedTarget, targetImage);
-
-      // Determin which orintatiion of images has the most overlap
-      // and thus is the proper orientation of the contour.
-      cv::bitwise_xor(shapeImage, targetImage, compareImage);
-      double bestValue = cv::countNonZero(compareImage);
-      int bestRot = 0;
-
-      for (int rot = 0; rot < 3; rot++) {
-        cv::Mat rotImage;
-        cv::rotate(shapeImage, rotImage, rot);
-
-        cv::bitwise_xor(rotImage, targetImage, compareImage);
-        double value = cv::countNonZero(compareImage);
-
-        if (value < bestValue) {
-          bestValue = value;
-          bestRot = (rot + 1) * -90;
-        }
+  // The target's cached normalized shape, or one made here if it's out of date.
+  const rv::NormalizedShape& currentNormalized(const rv::Target& target, rv::NormalizedShape& own) {
+    if (target.cacheBuilt()) {
+      return target.normalized;
+    }
+    own = rv::NormalizedShape(target.shape);
+    return own;
+  }
+
+  // Finds the points of a contour corosponding to each point of a target,
+  // from the contour already transformed into the same 255x255 frame as the
+  // target. The contour's points are put in shapePoints, matching up with
+  // the target's points in the order given by targetOrder.
+  bool correspondingPoints(const rv::NormalizedShape& normalized, const rv::NormalizedShape& target, 
+                           std::vector<cv::Point2f>& shapePoints, std::vector<int>& targetOrder, double& match) {
+    // Determin which orintatiion of the contour has moments closest to
+    // the target's, and thus is the proper orientation of the contour.
+    cv::Vec<double, 9> moments = normalized.moments;
+    double bestValue = DBL_MAX;
+    int bestRot = 0;
+
+    for (int rot = 0; rot < 4; rot++) {
+      double value = cv::norm(moments, target.moments, cv::NORM_L1) / moments.rows;
+
+      if (value < bestValue) {
+        bestValue = value;
+        bestRot = rot * -90;
       }
+      moments = rotateMoments(moments);
+    }
 
-      // Calculate the rotation matrix of that rotation.
-      // An extra row must be added to the bottom to 
-      // make it a perspective and not afline transform.
-      cv::Mat rotation;
-      cv::vconcat(cv::getRotationMatrix2D({128, 128}, bestRot, 1), cv::Matx13d{0, 0, 1}, rotation);
+    std::vector<cv::Point2f> projectedShape = normalized.points;
+    cv::Mat shapeTransform = normalized.transform;
 
-      cv::perspectiveTransform(projectedShape, projectedShape, rotation);
+    // Calculate the rotation matrix of that rotation.
+    // An extra row must be added to the bottom to 
+    // make it a perspective and not afline transform.
+    cv::Mat rotation;
+    cv::vconcat(cv::getRotationMatrix2D({128, 128}, bestRot, 1), cv::Matx13d{0, 0, 1}, rotation);
 
-      // Aproximate the contour to the same number of sides as the target
-      bool aproximated = approximateNGon(projectedShape, projectedShape, match.target.shape.size(), 15, 50, 0.5);
+    cv::perspectiveTransform(projectedShape, projectedShape, rotation);
 
-      if (!aproximated) {
-        continue;
-      }
+    // Aproximate the contour to the same number of sides as the target
+    bool aproximated = rv::approximateNGon(projectedShape, projectedShape, target.points.size(), 15, 50, 0.5);
+
+    if (!aproximated) {
+      return false;
+    }
+
+    // Reorder both the contour and the target so that they
+    // start with the point closes to the origin. This assures
+    // Point corospondence between the two.
+    rv::reorderPoints(projectedShape);
+    targetOrder = reorderedIndices(target.points);
+
+    // Transform the contour's points back to thier origional locations
+    cv::perspectiveTransform(projectedShape, shapePoints, (rotation * shapeTransform).inv());
+
+    // Update the match value with a more accurate one
+    // creaated during orientation matching.
+    match = std::max(1 - bestValue, 0.0);
+    return true;
+  }
 
-      // Reorder both the contour and the target so that they
-      // start with the point closes to the origin. This assures
-      // Point corospondence between the two.
-      reorderPoints(projectedShape);
-      reorderPoints(projectedTarget);
+  // Contours held in vectors, an arena or as features.
+  inline int contourCount(const std::vector<std::vector<cv::Point>>& contours) {
+    return contours.size();
+  }
+
+  inline int contourCount(const rv::ContourArena& contours) {
+    return contours.size();
+  }
+
+  inline int contourCount(const std::vector<rv::ContourFeatures>& features) {
+    return features.size();
+  }
+
+  // The features of a contour, either shared ones or
+  // ones kept in own for as long as they're used.
+  inline rv::ContourFeatures& featuresAt(const std::vector<std::vector<cv::Point>>& contours, int i, rv::ContourFeatures& own) {
+    own.reset(cv::Mat(contours[i]));
+    return own;
+  }
+
+  inline rv::ContourFeatures& featuresAt(const rv::ContourArena& contours, int i, rv::ContourFeatures& own) {
+    own.reset(contours.contour(i));
+    return own;
+  }
 
-      // Transform all the points back to thier origional locations
-      std::vector<cv::Point2f> outputContour, outputTarget;
-      cv::perspectiveTransform(projectedShape, outputContour, (rotation * shapeTransform).inv());
-      cv::perspectiveTransform(projectedTarget, outputTarget, targetTransform.inv());
+  inline rv::ContourFeatures& featuresAt(std::vector<rv::ContourFeatures>& features, int i, rv::ContourFeatures&) {
+    return features[i];
+  }
 
-      // Add the modifies contour and target to the match
-      rv::TargetMatch outputMatch = match;
-      outputMatch.shape = outputContour;
-      outputMatch.target.shape = outputTarget;
-      // Update the match value with a more accurate one
-      // creaated during orientation matching.
-      outputMatch.match = 1 - (bestRot / (255 * 255));
+  // A radial spread of this fraction of the radius gives an algebraic circle a match of 0.
+  const double maxCircleSpread = 0.1;
+
+  // Fits a circle to points by least squares on x^2 + y^2 + Dx + Ey + F = 0
+  // (the Kasa fit), which is linear so every sum is found in one pass. The
+  // points are taken relative to the first one to keep the sums small.
+  // Returns the RMS distance of the points from the circle, estimated
+  // from the algebraic error, which is about 2r times the distance.
+  double fitCircle(const cv::Point* points, int count, rv::Circle& circle) {
+    if (count < 3) {
+      circle.center = count > 0 ? cv::Point2f(points[0]) : cv::Point2f();
+      circle.radius = 0;
+      return 0;
+    }
 
-      output.push_back(outputMatch);
+    const cv::Point origin = points[0];
+    double su = 0, sv = 0, sz = 0, suu = 0, suv = 0, svv = 0, suz = 0, svz = 0, szz = 0;
+    for (int i = 0; i < count; i++) {
+      double u = points[i].x - origin.x, v = points[i].y - origin.y;
+      double z = u * u + v * v;
+      su += u; sv += v; sz += z;
+      suu += u * u; suv += u * v; svv += v * v;
+      suz += u * z; svz += v * z; szz += z * z;
     }
-    return output;
+
+    // Solve for D and E about the mean, then F from the means.
+    const double n = count;
+    double mu = su / n, mv = sv / n, mz = sz / n;
+    double cuu = suu / n - mu * mu, cuv = suv / n - mu * mv, cvv = svv / n - mv * mv;
+    double cuz = suz / n - mu * mz, cvz = svz / n - mv * mz;
+    double determinant = cuu * cvv - cuv * cuv;
+    if (determinant <= DBL_EPSILON * (cuu + cvv) * (cuu + cvv)) {
+      // All the points are on a line.
+      circle.center = cv::Point2f(mu + origin.x, mv + origin.y);
+      circle.radius = 0;
+      return 0;
+    }
+    double d = -(cvv * cuz - cuv * cvz) / determinant;
+    double e = -(cuu * cvz - cuv * cuz) / determinant;
+    double f = -(mz + d * mu + e * mv);
+
+    circle.center = cv::Point2f(origin.x - d / 2, origin.y - e / 2);
+    double radiusSquared = std::max((d * d + e * e) / 4 - f, 0.0);
+    circle.radius = std::sqrt(radiusSquared);
+
+    // The mean of (z + Du + Ev + F)^2, expanded into the sums.
+    double algebraic = szz + d * d * suu + e * e * svv + f * f * n
+                     + 2 * (d * suz + e * svz + f * sz + d * e * suv + d * f * su + e * f * sv);
+    algebraic = std::max(algebraic / n, 0.0);
+    return radiusSquared > 0 ? std::sqrt(algebraic) / (2 * circle.radius) : 0;
   }
 
-  std::vector<rv::TargetMatch> findTargets(std::vector<std::vector<cv::Point>> contours, std::vector<rv::Target> targets, double minArea, double minMatch) {
-    std::vector<rv::TargetMatch> matches;
+  template<typename Contours>
+  void matchTargetPointsIn(Contours& contours, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches) {
+    rv::parallelForEach(matches.size(), [&](int m) {
+      rv::IndexedTargetMatch& match = matches[m];
+      const rv::Target& target = targets[match.target];
+
+      rv::ContourFeatures ownFeatures;
+      rv::ContourFeatures& features = featuresAt(contours, match.contour, ownFeatures);
+      std::vector<cv::Point2f> shapePoints;
+      std::vector<int> targetOrder;
+      rv::NormalizedShape ownNormalized;
+      const rv::NormalizedShape& normalized = currentNormalized(target, ownNormalized);
+
+      // The contour's points are projected straight from its matrix header.
+      rv::NormalizedShape shape(features.contour(), features.minAreaRect());
+      if (!correspondingPoints(shape, normalized, shapePoints, targetOrder, match.match)) {
+        match.contour = -1;
+        return;
+      }
 
-    for (auto& contour : contours) {
+      // Put each point of the contour in the same place
+      // as the target point it corosponds to.
+      match.imagePoints.resize(shapePoints.size());
+      for (int i = 0; i < shapePoints.size(); i++) {
+        match.imagePoints[targetOrder[i]] = shapePoints[i];
+      }
+    });
 
-      // Make sure the contoyr isn't too small.
-      double contourArea = cv::contourArea(contour);
-      if (contourArea < minArea) {
-        continue;
+    // Matches that fail are removed, keeping the rest in order.
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [](const rv::IndexedTargetMatch& match) {
+      return match.contour < 0;
+    }), matches.end());
+  }
+
+  template<typename Contours>
+  void findTargetsIn(Contours& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    matches.clear();
+
+    // Use each target's cached moments, only finding them
+    // here if they are out of date.
+    std::vector<rv::HuMoments> ownMoments(targets.size());
+    std::vector<const rv::HuMoments*> targetMoments(targets.size(), nullptr);
+    for (int t = 0; t < targets.size(); t++) {
+      if (targets[t].cacheBuilt()) {
+        targetMoments[t] = &targets[t].huMoments;
+      } else if (!targets[t].shape.empty()) {
+        ownMoments[t] = rv::HuMoments(cv::moments(targets[t].shape));
+        targetMoments[t] = &ownMoments[t];
       }
+    }
+
+    // Each contour gets a slot, and the ones left without a target are
+    // removed after, so the order doesn't depend on the threads.
+    matches.assign(contourCount(contours), {-1, -1, 0, {}});
+    rv::parallelForEach(contourCount(contours), [&](int i) {
+      rv::ContourFeatures ownFeatures;
+      rv::ContourFeatures& features = featuresAt(contours, i, ownFeatures);
+
+      // Make sure the contoyr isn't too small, first by its bounding
+      // rect, then by the area from its moments.
+      if (features.boundingRect().area() < minArea || std::abs(features.moments().m00) < minArea) {
+        return;
+      }
+      const rv::HuMoments& contourMoments = features.huMoments();
 
       // Find the target that best matches each contour.
-      rv::Target matchingTarget;
-      double bestMatch = minMatch;
-      for (auto& target : targets) {
-        double matchValue = cv::matchShapes(contour, target.shape, cv::CONTOURS_MATCH_I1, 0);
+      int matchingTarget = -1;
+      double bestMatch = maxMatch;
+      for (int t = 0; t < targets.size(); t++) {
+        if (!targetMoments[t]) {
+          continue;
+        }
+        double matchValue = contourMoments.compare(*targetMoments[t]);
 
         if (matchValue < bestMatch) {
-            matchingTarget = target;
+            matchingTarget = t;
             bestMatch = matchValue;
         }
       }
 
       // If an adequet matching target could be found, add in to the vector. 
-      if (!matchingTarget.shape.empty()) {
-        matches.push_back({rv::convertToPoints<float>(contour), matchingTarget, bestMatch});
+      if (matchingTarget >= 0) {
+        matches[i] = {i, matchingTarget, bestMatch, {}};
       }
-    }
-    return matches;
+    });
+
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [](const rv::IndexedTargetMatch& match) {
+      return match.target < 0;
+    }), matches.end());
   }
 
-  std::vector<rv::TargetPose> estimateTargetPose(std::vector<TargetMatch> matches, cv::Mat cameraMatrix, cv::Mat distortion) {
-    // Run a position estimation over all the matches.
-    std::vector<rv::TargetPose> positions;
-    for (auto& match : matches) {
-      rv::TargetPose position;
-      cv::solvePnP(rv::convertToPoints3<float>(match.target.shape), match.shape, cameraMatrix, distortion, position.rvec, position.tvec);
-      positions.push_back(position);
-    }
-    return positions;
-  }  
+  template<typename Contours>
+  void findCirclesIn(Contours& contours, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method) {
+    matches.assign(contourCount(contours), {-1, rv::Circle(), 0});
+    rv::parallelForEach(contourCount(contours), [&](int i) {
 
-  std::vector<rv::CircleMatch> findCircles(std::vector<std::vector<cv::Point>> contours, double minArea, double minMatch) {
-    std::vector<rv::CircleMatch> matches;
-    for (auto& contour : contours) {
+      rv::ContourFeatures ownFeatures;
+      rv::ContourFeatures& features = featuresAt(contours, i, ownFeatures);
 
-      // Cheak if the contour is too small to consider
-      double contourArea = cv::contourArea(contour);
+      // Cheak if the contour is too small to consider, first by its
+      // bounding rect, which is never smaller than the contour.
+      if (features.boundingRect().area() < minArea) {
+        return;
+      }
+      double contourArea = features.area();
       if (contourArea < minArea) {
-        continue;
+        return;
       }
 
       rv::Circle circle;
-      cv::minEnclosingCircle(contour, circle.center, circle.radius);
-
-      // How much it fills the bounding circle
-      // This can also be though of as how circular it is
-      double matchValue = contourArea / circle.area();
+      double matchValue;
+      if (method == rv::CIRCLE_ALGEBRAIC) {
+        double spread = fitCircle(features.contour().ptr<cv::Point>(), features.contour().rows, circle);
+
+        // Points on the pixel grid are off by up to half a pixel, which
+        // spreads them by 1/12 of a pixel squared even on a perfect circle.
+        spread = std::sqrt(std::max(spread * spread - 1.0 / 12, 0.0));
+        matchValue = circle.radius > 0 ? std::max(1 - spread / (maxCircleSpread * circle.radius), 0.0) : 0;
+      } else {
+        cv::minEnclosingCircle(features.contour(), circle.center, circle.radius);
+
+        // How much it fills the bounding circle
+        // This can also be though of as how circular it is
+        matchValue = contourArea / circle.area();
+      }
 
       // If the match is sufficent, 
       if (matchValue > minMatch) {
-        matches.push_back({contour, circle, matchValue});
+        matches[i] = {i, circle, matchValue};
+      }
+    });
+
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [](const rv::IndexedCircleMatch& match) {
+      return match.contour < 0;
+    }), matches.end());
+  }
+  // Finds the center of each ball from its circle, without solvePnP.
+  // The circle is the outline of the cone of rays just touching the
+  // ball, so the angle between the ray through its center and the rays
+  // through its edge is the angular radius of the ball. The ball is then
+  // radius / sin(angle) along the center ray. All the points of every
+  // circle are undistorted in one call.
+  template<typename CircleMatches>
+  void locateBalls(const CircleMatches& circles, const rv::Ball& ball, const cv::Mat& cameraMatrix, const cv::Mat& distortion, std::vector<cv::Point3d>& centers) {
+    centers.resize(circles.size());
+    if (circles.empty()) {
+      return;
+    }
+
+    // The center followed by the four extreme points of each circle.
+    std::vector<cv::Point2f> points;
+    points.reserve(circles.size() * 5);
+    for (auto& match : circles) {
+      const rv::Circle& circle = match.circle;
+      points.push_back(circle.center);
+      points.push_back(circle.center + cv::Point2f(circle.radius, 0));
+      points.push_back(circle.center + cv::Point2f(0, circle.radius));
+      points.push_back(circle.center + cv::Point2f(-circle.radius, 0));
+      points.push_back(circle.center + cv::Point2f(0, -circle.radius));
+    }
+
+    // Gives points on the z = 1 plane, so each one is also its ray.
+    std::vector<cv::Point2f> rays;
+    cv::undistortPoints(points, rays, cameraMatrix, distortion);
+
+    for (int i = 0; i < circles.size(); i++) {
+      const cv::Point2f* ray = rays.data() + i * 5;
+      cv::Point3d center(ray[0].x, ray[0].y, 1);
+      center = center * (1.0 / cv::norm(center));
+
+      // Average the angle to each edge to even out the stretching
+      // of circles away from the middle of the image.
+      double angle = 0;
+      for (int e = 1; e < 5; e++) {
+        cv::Point3d edge(ray[e].x, ray[e].y, 1);
+        angle += std::atan2(cv::norm(center.cross(edge)), center.dot(edge));
       }
+      angle /= 4;
+
+      double distance = angle > 0 ? ball.radius / std::sin(angle) : 0;
+      centers[i] = center * distance;
+    }
+  }
+  // The target's object points, from its cache if it's up to date.
+  const std::vector<cv::Point3f>& currentObjectPoints(const rv::Target& target, std::vector<cv::Point3f>& own) {
+    if (target.cacheBuilt()) {
+      return target.objectPoints;
+    }
+    own = rv::convertToPoints3<float>(target.shape);
+    return own;
+  }
+
+  // Solves the pose of a flat target from undistorted image points.
+  // IPPE is made for flat targets, but needs at least 4 points.
+  void solvePlanarPose(const std::vector<cv::Point3f>& objectPoints, const std::vector<cv::Point2f>& undistorted, cv::Mat& rvec, cv::Mat& tvec) {
+    int method = objectPoints.size() >= 4 ? cv::SOLVEPNP_IPPE : cv::SOLVEPNP_ITERATIVE;
+    cv::solvePnP(objectPoints, undistorted, cv::Mat::eye(3, 3, CV_64F), cv::Mat(), rvec, tvec, false, method);
+  }
+
+  // Levenberg-Marquardt iterations allowed when refining last frame's pose.
+  const int warmIterations = 5;
+
+  // The RMS distance in pixels between image points and where a pose puts thier object points.
+  double reprojectionError(const std::vector<cv::Point3f>& objectPoints, const std::vector<cv::Point2f>& imagePoints, const cv::Mat& cameraMatrix, const cv::Mat& distortion, const cv::Mat& rvec, const cv::Mat& tvec) {
+    if (imagePoints.empty()) {
+      return 0;
+    }
+
+    std::vector<cv::Point2f> projected;
+    cv::projectPoints(objectPoints, rvec, tvec, cameraMatrix, distortion, projected);
+
+    double total = 0;
+    for (int i = 0; i < imagePoints.size(); i++) {
+      cv::Point2f offset = projected[i] - imagePoints[i];
+      total += offset.dot(offset);
+    }
+    return std::sqrt(total / imagePoints.size());
+  }
+}
+
+namespace rv {
+  void setParallelThreshold(int count) {
+    parallelThreshold = std::max(count, 1);
+  }
+
+  int getParallelThreshold() {
+    return parallelThreshold;
+  }
+
+  HuMoments::HuMoments(const cv::Moments& moments) {
+    double hu[7];
+    cv::HuMoments(moments, hu);
+
+    // The same scaling cv::matchShapes uses, ignoring
+    // any moments too small to compare.
+    for (int i = 0; i < 7; i++) {
+      double magnitude = std::abs(hu[i]);
+      values[i] = magnitude > 1e-5 ? 1 / ((hu[i] > 0 ? 1 : -1) * std::log10(magnitude)) : 0;
+    }
+  }
+
+  double HuMoments::compare(const rv::HuMoments& other) const {
+    double result = 0;
+    bool any = false, otherAny = false;
+    for (int i = 0; i < 7; i++) {
+      any = any || values[i] != 0;
+      otherAny = otherAny || other.values[i] != 0;
+      if (values[i] != 0 && other.values[i] != 0) {
+        result += std::abs(other.values[i] - values[i]);
+      }
+    }
+
+    // A shape with no usable moments can't match one that has some.
+    return any == otherAny ? result : DBL_MAX;
+  }
+
+  NormalizedShape::NormalizedShape(const std::vector<cv::Point2f>& shape) : NormalizedShape(shape, cv::minAreaRect(shape)) {}
+
+  NormalizedShape::NormalizedShape(const std::vector<cv::Point2f>& shape, const cv::RotatedRect& bounds) {
+    transform = normalizingTransform(bounds);
+    cv::perspectiveTransform(shape, points, transform);
+    moments = normalizedMoments(points);
+  }
+
+  NormalizedShape::NormalizedShape(const cv::Mat& contour, const cv::RotatedRect& bounds) {
+    CV_Assert(contour.type() == CV_32SC2 && contour.isContinuous());
+    transform = normalizingTransform(bounds);
+
+    // The same projection as cv::perspectiveTransform, reading the
+    // integer points in place instead of from a float copy.
+    const cv::Matx33d m = transform;
+    const cv::Point* contourPoints = contour.ptr<cv::Point>();
+    points.resize(contour.total());
+    for (int i = 0; i < points.size(); i++) {
+      const double x = contourPoints[i].x, y = contourPoints[i].y;
+      const double w = m(2, 0) * x + m(2, 1) * y + m(2, 2);
+      const double scale = w != 0 ? 1 / w : 0;
+      points[i] = cv::Point2f((m(0, 0) * x + m(0, 1) * y + m(0, 2)) * scale, (m(1, 0) * x + m(1, 1) * y + m(1, 2)) * scale);
+    }
+    moments = normalizedMoments(points);
+  }
+
+  void Target::updateCache() {
+    if (!cacheBuilt()) {
+      huMoments = rv::HuMoments(cv::moments(shape));
+      normalized = rv::NormalizedShape(shape);
+      objectPoints = rv::convertToPoints3<float>(shape);
+      cachedShape = shape;
+    }
+  }
+
+  const cv::Rect& ContourFeatures::boundingRect() {
+    if (!(computed & BOUNDING_RECT)) {
+      bounds = cv::boundingRect(points);
+      computed |= BOUNDING_RECT;
+    }
+    return bounds;
+  }
+
+  double ContourFeatures::area() {
+    if (!(computed & AREA)) {
+      contourArea = computed & MOMENTS ? std::abs(contourMoments.m00) : cv::contourArea(points);
+      computed |= AREA;
+    }
+    return contourArea;
+  }
+
+  const cv::Moments& ContourFeatures::moments() {
+    if (!(computed & MOMENTS)) {
+      contourMoments = cv::moments(points);
+      computed |= MOMENTS;
+    }
+    return contourMoments;
+  }
+
+  const rv::HuMoments& ContourFeatures::huMoments() {
+    if (!(computed & HU_MOMENTS)) {
+      hu = rv::HuMoments(moments());
+      computed |= HU_MOMENTS;
+    }
+    return hu;
+  }
+
+  const std::vector<cv::Point>& ContourFeatures::convexHull() {
+    if (!(computed & CONVEX_HULL)) {
+      cv::convexHull(points, hull);
+      computed |= CONVEX_HULL;
+    }
+    return hull;
+  }
+
+  const cv::RotatedRect& ContourFeatures::minAreaRect() {
+    if (!(computed & MIN_AREA_RECT)) {
+      // The bounding rect only touches the hull, so it's the same either way.
+      rotatedBounds = cv::minAreaRect(convexHull());
+      computed |= MIN_AREA_RECT;
+    }
+    return rotatedBounds;
+  }
+
+  void findFeatures(const std::vector<std::vector<cv::Point>>& contours, std::vector<rv::ContourFeatures>& features) {
+    features.resize(contours.size());
+    for (int i = 0; i < contours.size(); i++) {
+      features[i].reset(cv::Mat(contours[i]));
+    }
+  }
+
+  void findFeatures(const rv::ContourArena& contours, std::vector<rv::ContourFeatures>& features) {
+    features.resize(contours.size());
+    for (int i = 0; i < contours.size(); i++) {
+      features[i].reset(contours.contour(i));
+    }
+  }
+
+  std::vector<cv::Point3f> rv::Ball::points() const {
+    return std::vector<cv::Point3f> {
+      center,
+      cv::Point3f{radius,  0, 0} + center,
+      cv::Point3f{0, radius,  0} + center,
+      cv::Point3f{-radius, 0, 0} + center,
+      cv::Point3f{0, -radius, 0} + center
+    };
+  }
+
+  double rv::Circle::area() const {
+    return radius * radius * M_PI;
+  }
+
+  std::vector<cv::Point2f> rv::Circle::points() const {
+    return std::vector<cv::Point2f> {
+      center,
+      cv::Point2f{radius,  0} + center,
+      cv::Point2f{0,  radius} + center,
+      cv::Point2f{-radius, 0} + center,
+      cv::Point2f{0, -radius} + center
+    };
+  }
+
+  bool approximateNGon(const std::vector<cv::Point2f>& src, std::vector<cv::Point2f>& dst, int n, double start, double end, double step) {
+    if (src.size() < 2 || n < 2) {
+      return false;
+    }
+
+    std::vector<double> importance;
+    polygonImportance(src, importance);
+
+    // A point is kept when its importance is above the error, so the
+    // smallest error with at most n points is the n+1th highest importance.
+    double needed = 0;
+    if (importance.size() > n) {
+      std::vector<double> sorted = importance;
+      std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end(), std::greater<double>());
+      needed = sorted[n];
+    }
+
+    // Round up to the first error that would have been tried.
+    double epsilon = start;
+    if (needed > start) {
+      epsilon = start + std::ceil((needed - start) / step) * step;
+    }
+    if (epsilon >= end) {
+      return false;
+    }
+
+    std::vector<cv::Point2f> aprox;
+    for (int i = 0; i < src.size(); i++) {
+      if (importance[i] > epsilon) {
+        aprox.push_back(src[i]);
+      }
+    }
+
+    // If the approximation has too few sides it failed.
+    if (aprox.size() != n) {
+      return false;
+    }
+
+    dst = aprox;
+    return true;
+  }
+
+  void reorderPoints(std::vector<cv::Point2f>& points) {
+    std::vector<cv::Point2f> reordered;
+    reordered.reserve(points.size());
+    for (int i : reorderedIndices(points)) {
+      reordered.push_back(points[i]);
+    }
+    points = reordered;
+  }
+
+  cv::Mat normalizedContourImage(const std::vector<cv::Point2f>& contour, std::vector<cv::Point2f>& projectedContour, cv::Mat& image) {
+    // Transform the poins such that the bounding rect
+    // is now the fram of 255 x 255 image.
+    cv::Mat transform = normalizingTransform(cv::minAreaRect(contour));
+
+    // TODO: Fix error here
+    cv::perspectiveTransform(contour, projectedContour, transform);
+
+    // Draw the points on to the image
+    image = cv::Mat(256, 256, CV_8UC1, cv::Scalar(0));
+    cv::drawContours(image, std::vector<std::vector<cv::Point>>(1, rv::convertToPoints<int>(projectedContour)), 0, 255, -1);
+
+    // Return the matrix used to transform the points.
+    return transform;
+  }
+
+  std::vector<rv::TargetMatch> matchTargetPoints(const std::vector<rv::TargetMatch>& matches) {
+    std::vector<rv::TargetMatch> processed(matches.size());
+    std::vector<char> found(matches.size(), false);
+
+    rv::parallelForEach(matches.size(), [&](int m) {
+      const rv::TargetMatch& match = matches[m];
+      std::vector<cv::Point2f> shapePoints;
+      std::vector<int> targetOrder;
+      double matchValue;
+      rv::NormalizedShape ownNormalized;
+      const rv::NormalizedShape& normalized = currentNormalized(match.target, ownNormalized);
+      if (!correspondingPoints(rv::NormalizedShape(match.shape), normalized, shapePoints, targetOrder, matchValue)) {
+        return;
+      }
+
+      // Add the reordered contour and target to the match
+      rv::TargetMatch& outputMatch = processed[m];
+      outputMatch = match;
+      outputMatch.shape = shapePoints;
+      for (int i = 0; i < targetOrder.size(); i++) {
+        outputMatch.target.shape[i] = match.target.shape[targetOrder[i]];
+      }
+      outputMatch.match = matchValue;
+      found[m] = true;
+    });
+
+    // Keep the matches that worked in thier origional order.
+    std::vector<rv::TargetMatch> output;
+    for (int m = 0; m < processed.size(); m++) {
+      if (found[m]) {
+        output.push_back(std::move(processed[m]));
+      }
+    }
+    return output;
+  }
+
+  void matchTargetPoints(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches) {
+    matchTargetPointsIn(contours, targets, matches);
+  }
+
+  void matchTargetPoints(const rv::ContourArena& contours, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches) {
+    matchTargetPointsIn(contours, targets, matches);
+  }
+
+  void matchTargetPoints(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, std::vector<rv::IndexedTargetMatch>& matches) {
+    matchTargetPointsIn(features, targets, matches);
+  }
+
+  std::vector<rv::TargetMatch> findTargets(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch) {
+    std::vector<rv::IndexedTargetMatch> indexed;
+    findTargets(contours, targets, minArea, maxMatch, indexed);
+
+    std::vector<rv::TargetMatch> matches;
+    for (auto& match : indexed) {
+      matches.push_back({rv::convertToPoints<float>(contours[match.contour]), targets[match.target], match.match});
     }
     return matches;
   }
 
-  std::vector<rv::BallPose> estimateBallPose(std::vector<CircleMatch> circles, rv::Ball ball, cv::Mat cameraMatrix, cv::Mat distortion) {
-    std::vector<rv::BallPose> positions;
-    // Run a position estimation over all the balls.
-    for (auto& circle : circles) {
-      rv::BallPose position;
-      position.circleMatch = circle;
+  void findTargets(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(contours, targets, minArea, maxMatch, matches);
+  }
+
+  void findTargets(const rv::ContourArena& contours, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(contours, targets, minArea, maxMatch, matches);
+  }
+
+  void findTargets(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(features, targets, minArea, maxMatch, matches);
+  }
+
+  std::vector<rv::TargetPose> estimateTargetPose(const std::vector<rv::TargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion) {
+    // Run a position estimation over all the matches.
+    std::vector<rv::TargetPose> positions(matches.size());
+    rv::parallelForEach(matches.size(), [&](int i) {
+      rv::TargetPose& position = positions[i];
+      position.match = matches[i];
+
+      std::vector<cv::Point3f> ownPoints;
+      const std::vector<cv::Point3f>& objectPoints = currentObjectPoints(matches[i].target, ownPoints);
+
+      std::vector<cv::Point2f> undistorted;
+      if (!matches[i].shape.empty()) {
+        cv::undistortPoints(matches[i].shape, undistorted, cameraMatrix, distortion);
+      }
+      solvePlanarPose(objectPoints, undistorted, position.rvec, position.tvec);
+      position.error = reprojectionError(objectPoints, matches[i].shape, cameraMatrix, distortion, position.rvec, position.tvec);
+    });
+    return positions;
+  }
+
+  void estimateTargetPose(const std::vector<rv::Target>& targets, const std::vector<rv::IndexedTargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion, std::vector<rv::IndexedTargetPose>& poses) {
+    estimateTargetPose(targets, matches, cameraMatrix, distortion, {}, 0, poses);
+  }
+
+  void estimateTargetPose(const std::vector<rv::Target>& targets, const std::vector<rv::IndexedTargetMatch>& matches, const cv::Mat& cameraMatrix, const cv::Mat& distortion, const std::vector<rv::IndexedTargetPose>& previous, double maxError, std::vector<rv::IndexedTargetPose>& poses) {
+    CV_Assert(&previous != &poses);
+    poses.resize(matches.size());
+
+    // Undistort the points of every match in one call, so the solvers
+    // can work with an ideal camera.
+    std::vector<int> starts(matches.size() + 1, 0);
+    std::vector<cv::Point2f> imagePoints, undistorted;
+    for (int i = 0; i < matches.size(); i++) {
+      imagePoints.insert(imagePoints.end(), matches[i].imagePoints.begin(), matches[i].imagePoints.end());
+      starts[i + 1] = imagePoints.size();
+    }
+    if (!imagePoints.empty()) {
+      cv::undistortPoints(imagePoints, undistorted, cameraMatrix, distortion);
+    }
+
+    // Run a position estimation over all the matches.
+    rv::parallelForEach(matches.size(), [&](int i) {
+      const rv::IndexedTargetMatch& match = matches[i];
+      rv::IndexedTargetPose& pose = poses[i];
+      pose.match = i;
+      pose.target = match.target;
+
+      cv::Rect bounds = cv::boundingRect(match.imagePoints);
+      pose.center = cv::Point2f(0, 0);
+      for (auto& point : match.imagePoints) {
+        pose.center += point;
+      }
+      pose.center *= 1.0f / std::max<int>(match.imagePoints.size(), 1);
+
+      std::vector<cv::Point3f> ownPoints;
+      const std::vector<cv::Point3f>& objectPoints = currentObjectPoints(targets[match.target], ownPoints);
+      const std::vector<cv::Point2f> points(undistorted.begin() + starts[i], undistorted.begin() + starts[i + 1]);
+
+      // Last frame's pose of the same target, if it hasn't moved
+      // further than its own size.
+      const rv::IndexedTargetPose* last = nullptr;
+      double lastDistance = std::max(bounds.width, bounds.height);
+      for (auto& candidate : previous) {
+        cv::Point2f offset = candidate.center - pose.center;
+        double distance = std::sqrt(offset.dot(offset));
+        if (candidate.target == match.target && !candidate.rvec.empty() && distance <= lastDistance) {
+          last = &candidate;
+          lastDistance = distance;
+        }
+      }
+
+      if (last) {
+        last->rvec.convertTo(pose.rvec, CV_64F);
+        last->tvec.convertTo(pose.tvec, CV_64F);
+        cv::solvePnPRefineLM(objectPoints, points, cv::Mat::eye(3, 3, CV_64F), cv::Mat(), pose.rvec, pose.tvec, cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, warmIterations, FLT_EPSILON));
+        pose.error = reprojectionError(objectPoints, match.imagePoints, cameraMatrix, distortion, pose.rvec, pose.tvec);
+        if (pose.error <= maxError) {
+          return;
+        }
+      }
+
+      solvePlanarPose(objectPoints, points, pose.rvec, pose.tvec);
+      pose.error = reprojectionError(objectPoints, match.imagePoints, cameraMatrix, distortion, pose.rvec, pose.tvec);
+    });
+  }
+
+  std::vector<rv::CircleMatch> findCircles(const std::vector<std::vector<cv::Point>>& contours, double minArea, double minMatch, int method) {
+    std::vector<rv::IndexedCircleMatch> indexed;
+    findCircles(contours, minArea, minMatch, indexed, method);
+
+    std::vector<rv::CircleMatch> matches;
+    for (auto& match : indexed) {
+      matches.push_back({contours[match.contour], match.circle, match.match});
+    }
+    return matches;
+  }
+
+  void findCircles(const std::vector<std::vector<cv::Point>>& contours, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method) {
+    findCirclesIn(contours, minArea, minMatch, matches, method);
+  }
+
+  void findCircles(const rv::ContourArena& contours, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method) {
+    findCirclesIn(contours, minArea, minMatch, matches, method);
+  }
+
+  void findCircles(std::vector<rv::ContourFeatures>& features, double minArea, double minMatch, std::vector<rv::IndexedCircleMatch>& matches, int method) {
+    findCirclesIn(features, minArea, minMatch, matches, method);
+  }
+
+  std::vector<rv::BallPose> estimateBallPose(const std::vector<rv::CircleMatch>& circles, const rv::Ball& ball, const cv::Mat& cameraMatrix, const cv::Mat& distortion) {
+    std::vector<cv::Point3d> centers;
+    locateBalls(circles, ball, cameraMatrix, distortion, centers);
+
+    // A ball looks the same from every side, so it has no rotation,
+    // and only the offset of its center in the ball's own points moves it.
+    std::vector<rv::BallPose> positions(circles.size());
+    for (int i = 0; i < circles.size(); i++) {
+      rv::BallPose& position = positions[i];
+      position.circleMatch = circles[i];
       position.ball = ball;
-      cv::solvePnP(ball.points(), circle.circle.points(), cameraMatrix, distortion, position.rvec, position.tvec);
-      positions.push_back(position);
+      position.tvec = cv::Mat(cv::Matx31d(centers[i].x - ball.center.x, centers[i].y - ball.center.y, centers[i].z - ball.center.z));
+      position.rvec = cv::Mat::zeros(3, 1, CV_64F);
     }
     return positions;
   }
-}
\ No newline at end of file
+
+  void estimateBallPose(const std::vector<rv::IndexedCircleMatch>& circles, const rv::Ball& ball, const cv::Mat& cameraMatrix, const cv::Mat& distortion, std::vector<rv::IndexedBallPose>& poses) {
+    std::vector<cv::Point3d> centers;
+    locateBalls(circles, ball, cameraMatrix, distortion, centers);
+
+    // Written in place so the matrices are reused between frames.
+    poses.resize(circles.size());
+    for (int i = 0; i < circles.size(); i++) {
+      rv::IndexedBallPose& pose = poses[i];
+      pose.circle = i;
+
+      pose.tvec.create(3, 1, CV_64F);
+      pose.tvec.at<double>(0) = centers[i].x - ball.center.x;
+      pose.tvec.at<double>(1) = centers[i].y - ball.center.y;
+      pose.tvec.at<double>(2) = centers[i].z - ball.center.z;
+
+      pose.rvec.create(3, 1, CV_64F);
+      pose.rvec.setTo(0);
+    }
+  }
+}
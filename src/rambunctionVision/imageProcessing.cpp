@@ -1,33 +1,425 @@
 #include "rambunctionVision/imageProcessing.hpp"
 
 #include <vector>
+#include <algorithm>
 #include <filesystem>
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+namespace {
+  // Fixed point precision OpenCV uses for 8-bit HSV conversion.
+  const int hsvShift = 12;
+
+  // Division tables identical to the ones cv::cvtColor builds, so
+  // the fused conversion gives back the exact same HSV values.
+  struct HsvTables {
+    int sdiv[256];
+    int hdiv[256];
+
+    HsvTables() {
+      sdiv[0] = hdiv[0] = 0;
+      for (int i = 1; i < 256; i++) {
+        sdiv[i] = cvRound((255 << hsvShift) / (1.0 * i));
+        hdiv[i] = cvRound((180 << hsvShift) / (6.0 * i));
+      }
+    }
+  };
+
+  const HsvTables& hsvTables() {
+    static const HsvTables tables;
+    return tables;
+  }
+
+  // Converts a single BGR pixel to HSV the same way cv::cvtColor does.
+  inline void bgrToHsv(int b, int g, int r, const HsvTables& tables, int& h, int& s, int& v) {
+    v = std::max(b, std::max(g, r));
+    int diff = v - std::min(b, std::min(g, r));
+    int vr = v == r ? -1 : 0;
+    int vg = v == g ? -1 : 0;
+
+    s = (diff * tables.sdiv[v] + (1 << (hsvShift - 1))) >> hsvShift;
+    h = (vr & (g - b)) + (~vr & ((vg & (b - r + 2 * diff)) + ((~vg) & (r - g + 4 * diff))));
+    h = (h * tables.hdiv[diff] + (1 << (hsvShift - 1))) >> hsvShift;
+    h += h < 0 ? 180 : 0;
+  }
+
+  // Whether a hsv color falls in the bounds, allowing the hue to wrap around 180.
+  inline bool inBounds(int h, int s, int v, const cv::Scalar_<int>& low, const cv::Scalar_<int>& high) {
+    bool hue = (low[0] > high[0]) ? (h >= low[0] || h <= high[0]) : (h >= low[0] && h <= high[0]);
+    return hue && s >= low[1] && s <= high[1] && v >= low[2] && v <= high[2];
+  }
+
+  // Turns a box filter sum back into a rounded average.
+  struct BoxDivider {
+    double scale;
+
+    explicit BoxDivider(int area) : scale(1.0 / area) {}
+
+    inline int operator()(int sum) const {
+      return cvRound(sum * scale);
+    }
+  };
+
+  // Applies morphology with the binary morphology engine when the kernel is
+  // large enough for it to be faster, otherwise with cv::morphologyEx. The 
+  // engine is only rebuilt when the kernel changes. The source is often a
+  // view of a larger scratch buffer, so cv::morphologyEx is told to treat
+  // it as isolated rather than read whatever was left past its edges.
+  void applyMorphology(rv::BinaryMorphology& morphology, int op, const cv::Mat& kernel, const cv::Mat& src, cv::Mat& dst) {
+    if (!morphology.sameKernel(kernel)) {
+      morphology.setKernel(kernel);
+    }
+
+    if (morphology.preferred()) {
+      morphology.apply(op, src, dst);
+    } else {
+      cv::morphologyEx(src, dst, op, kernel, cv::Point(-1, -1), 1, cv::BORDER_CONSTANT | cv::BORDER_ISOLATED, cv::morphologyDefaultBorderValue());
+    }
+  }
+
+  // Thresholds an hsv image, allowing the hue range to wrap around 180.
+  // `upper` is a buffer for the second half of a wrapping range.
+  void rangeThreshold(const cv::Mat& hsv, cv::Mat& dst, const rv::Threshold& threshold, cv::Mat& upper) {
+    if (threshold.wrapsHue()) {
+      // A wrapping hue range is the union of the two ends of the hue range.
+      cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(180, threshold.high[1], threshold.high[2]), dst);
+      cv::inRange(hsv, cv::Scalar(0, threshold.low[1], threshold.low[2]), cv::Scalar(threshold.high), upper);
+      cv::bitwise_or(dst, upper, dst);
+    } else {
+      cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(threshold.high), dst);
+    }
+  }
+
+  // Gets the threshold's own color table, or if it is out of date,
+  // keeps `own` up to date and uses that instead.
+  const rv::ColorTable& currentTable(const rv::Threshold& threshold, rv::ColorTable& own) {
+    if (threshold.table.builtFor(threshold.low, threshold.high)) {
+      return threshold.table;
+    }
+    if (!own.builtFor(threshold.low, threshold.high)) {
+      own.build(threshold.low, threshold.high);
+    }
+    return own;
+  }
+
+  // A view of the top left of a scratch buffer. The buffer only grows when
+  // an image is bigger than any before it, so regions of diffrent sizes
+  // share it instead of each reallocating it.
+  cv::Mat scratch(cv::Mat& buffer, cv::Size size, int type) {
+    if (buffer.type() != type || buffer.rows < size.height || buffer.cols < size.width) {
+      buffer.create(std::max(buffer.rows, size.height), std::max(buffer.cols, size.width), type);
+    }
+    return buffer(cv::Rect(0, 0, size.width, size.height));
+  }
+
+  // A set of hsv bounds to check in the fused pass and the mask to write to.
+  struct FusedRange {
+    cv::Scalar_<int> low, high;
+    cv::Mat* dst;
+    uchar* row;
+  };
+
+  // Blurs, converts and thresholds the rows [start, end) of the source,
+  // checking every range against each converted pixel.
+  //
+  // `sums` holds the vertical sum of the blur window for every column that
+  // is needed, and is slid down one row at a time. `columns` maps each
+  // position of the horizontal window to its column in `sums`. Like cv::blur,
+  // pixels outside of a submatrix are read from the parent image, and the
+  // border is only reflected at the edges of the parent image.
+  void fusedThresholdRows(const cv::Mat& src, int blurSize, FusedRange* ranges, int count, int start, int end, std::vector<int>& sums, std::vector<int>& columns) {
+    const HsvTables& tables = hsvTables();
+    const int ksize = std::max(blurSize, 1);
+    const int anchor = ksize / 2;
+    const BoxDivider divide(ksize * ksize);
+
+    cv::Size wholeSize;
+    cv::Point offset;
+    src.locateROI(wholeSize, offset);
+
+    // Find which columns of the parent image the blur will touch.
+    columns.resize(src.cols + ksize - 1);
+    int first = wholeSize.width, last = 0;
+    for (int i = 0; i < columns.size(); i++) {
+      columns[i] = cv::borderInterpolate(offset.x + i - anchor, wholeSize.width, cv::BORDER_REFLECT_101);
+      first = std::min(first, columns[i]);
+      last = std::max(last, columns[i] + 1);
+    }
+    for (auto& column : columns) {
+      column = (column - first) * 3;
+    }
+
+    // Rows are found in the parent image, and then pointed
+    // to relative to the start of the submatrix.
+    const int width = (last - first) * 3;
+    const uchar* origin = src.ptr<uchar>(0) + (first - offset.x) * 3;
+    auto sourceRow = [&](int y) {
+      int row = cv::borderInterpolate(offset.y + y, wholeSize.height, cv::BORDER_REFLECT_101) - offset.y;
+      return origin + static_cast<std::ptrdiff_t>(row) * static_cast<std::ptrdiff_t>(src.step);
+    };
+
+    // Sum up the first window of rows.
+    sums.assign(width, 0);
+    for (int y = start - anchor; y < start - anchor + ksize; y++) {
+      const uchar* row = sourceRow(y);
+      for (int i = 0; i < width; i++) {
+        sums[i] += row[i];
+      }
+    }
+
+    for (int y = start; y < end; y++) {
+      const int* sum = sums.data();
+      for (int k = 0; k < count; k++) {
+        ranges[k].row = ranges[k].dst->ptr<uchar>(y);
+      }
+
+      // Horizontal sum of the window for the first pixel.
+      int sumB = 0, sumG = 0, sumR = 0;
+      for (int i = 0; i < ksize; i++) {
+        sumB += sum[columns[i]];
+        sumG += sum[columns[i] + 1];
+        sumR += sum[columns[i] + 2];
+      }
+
+      for (int x = 0; x < src.cols; x++) {
+        int h, s, v;
+        bgrToHsv(divide(sumB), divide(sumG), divide(sumR), tables, h, s, v);
+
+        for (int k = 0; k < count; k++) {
+          ranges[k].row[x] = inBounds(h, s, v, ranges[k].low, ranges[k].high) ? 255 : 0;
+        }
+
+        // Slide the horizontal window over by one pixel.
+        if (x + 1 < src.cols) {
+          const int* add = sum + columns[x + ksize];
+          const int* sub = sum + columns[x];
+          sumB += add[0] - sub[0];
+          sumG += add[1] - sub[1];
+          sumR += add[2] - sub[2];
+        }
+      }
+
+      // Slide the vertical window down by one row. This loop
+      // is kept simple so the compiler can vectorize it.
+      if (y + 1 < end) {
+        const uchar* add = sourceRow(y - anchor + ksize);
+        const uchar* sub = sourceRow(y - anchor);
+        int* update = sums.data();
+        for (int i = 0; i < width; i++) {
+          update[i] += add[i] - sub[i];
+        }
+      }
+    }
+  }
+}
+
 namespace rv {
-  void thresholdImage(cv::Mat& src, cv::Mat& dst, rv::Threshold threshold) {
-    cv::Mat blur, hsv, thresh, open, close;
+  void ColorTable::build(const cv::Scalar_<int>& low, const cv::Scalar_<int>& high, int bits) {
+    const HsvTables& tables = hsvTables();
+    this->bits = std::clamp(bits, 1, 8);
+    shift = 8 - this->bits;
+    tableLow = low;
+    tableHigh = high;
+
+    const int levels = 1 << this->bits;
+    table = cv::Mat::zeros(1, std::max((levels * levels * levels) / 8, 1), CV_8UC1);
+
+    // Classify each quantized color by the center of its cell.
+    const int center = (1 << shift) >> 1;
+    int index = 0;
+    for (int b = 0; b < levels; b++) {
+      for (int g = 0; g < levels; g++) {
+        for (int r = 0; r < levels; r++, index++) {
+          int h, s, v;
+          bgrToHsv((b << shift) + center, (g << shift) + center, (r << shift) + center, tables, h, s, v);
+
+          if (inBounds(h, s, v, low, high)) {
+            table.data[index >> 3] |= 1 << (index & 7);
+          }
+        }
+      }
+    }
+  }
+
+  void ColorTable::apply(const cv::Mat& src, cv::Mat& dst) const {
+    CV_Assert(src.type() == CV_8UC3 && !table.empty());
+    dst.create(src.size(), CV_8UC1);
+
+    for (int y = 0; y < src.rows; y++) {
+      const uchar* pixel = src.ptr<uchar>(y);
+      uchar* mask = dst.ptr<uchar>(y);
+
+      for (int x = 0; x < src.cols; x++, pixel += 3) {
+        mask[x] = contains(pixel[0], pixel[1], pixel[2]) ? 255 : 0;
+      }
+    }
+  }
+
+  void fusedThreshold(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold) {
+    CV_Assert(src.type() == CV_8UC3);
+    dst.create(src.size(), CV_8UC1);
+
+    std::vector<int> sums, columns;
+    FusedRange range = {threshold.low, threshold.high, &dst, nullptr};
+    fusedThresholdRows(src, threshold.blurSize, &range, 1, 0, src.rows, sums, columns);
+  }
+
+  void ThresholdContext::reserve(cv::Size frameSize) {
+    blur.create(frameSize, CV_8UC3);
+    hsv.create(frameSize, CV_8UC3);
+    thresh.create(frameSize, CV_8UC1);
+    open.create(frameSize, CV_8UC1);
+    upper.create(frameSize, CV_8UC1);
+
+    // Enough for the columns of the frame plus a large blur.
+    sums.reserve((frameSize.width + 128) * 3);
+    columns.reserve(frameSize.width + 128);
+  }
 
-    // Mean blur over the image to remove noise
-    cv::blur(src, blur, cv::Size(std::max(threshold.blurSize, 1), std::max(threshold.blurSize, 1)));
+  void ThresholdContext::apply(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold) {
+    const cv::Size blurSize(std::max(threshold.blurSize, 1), std::max(threshold.blurSize, 1));
 
-    // Convert to hsv color spave amd threshold
-    cv::cvtColor(blur, hsv, cv::COLOR_BGR2HSV);
-    cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(threshold.high), thresh);
+    // Every buffer is used through a view the size of the image, so
+    // smaller regions of a frame reuse the frame sized buffers.
+    cv::Mat threshView = scratch(thresh, src.size(), CV_8UC1);
+    cv::Mat openView = scratch(open, src.size(), CV_8UC1);
+
+    if (method == THRESHOLD_FUSED) {
+      // Blur, convert and threshold in one pass
+      CV_Assert(src.type() == CV_8UC3);
+      FusedRange range = {threshold.low, threshold.high, &threshView, nullptr};
+      fusedThresholdRows(src, threshold.blurSize, &range, 1, 0, src.rows, sums, columns);
+    } else if (method == THRESHOLD_TABLE) {
+      // Mean blur over the image to remove noise
+      cv::Mat blurView = scratch(blur, src.size(), CV_8UC3);
+      cv::blur(src, blurView, blurSize);
+
+      // Classify each pixel with the lookup table.
+      currentTable(threshold, table).apply(blurView, threshView);
+    } else {
+      // Mean blur over the image to remove noise
+      cv::Mat blurView = scratch(blur, src.size(), CV_8UC3);
+      cv::blur(src, blurView, blurSize);
+
+      // Convert to hsv color spave amd threshold
+      cv::Mat hsvView = scratch(hsv, src.size(), CV_8UC3);
+      cv::Mat upperView = scratch(upper, src.size(), CV_8UC1);
+      cv::cvtColor(blurView, hsvView, cv::COLOR_BGR2HSV);
+      rangeThreshold(hsvView, threshView, threshold, upperView);
+    }
 
     // Use morphology to close any holes, and remove any extra noise
-    cv::morphologyEx(thresh, open, cv::MORPH_OPEN, threshold.openMatrix);
-    cv::morphologyEx(open, close, cv::MORPH_CLOSE, threshold.closeMatrix);
+    applyMorphology(openMorphology, cv::MORPH_OPEN, threshold.openMatrix, threshView, openView);
+    applyMorphology(closeMorphology, cv::MORPH_CLOSE, threshold.closeMatrix, openView, dst);
+  }
+
+  void ThresholdContext::apply(const cv::Mat& src, std::vector<cv::Mat>& dst, const std::vector<rv::Threshold>& thresholds) {
+    const int count = thresholds.size();
+    dst.resize(count);
+    masks.resize(count);
+    tables.resize(count);
+    openMorphologies.resize(count);
+    closeMorphologies.resize(count);
 
-    // Output the fila image
-    dst = close;
+    auto blurOf = [&](int i) { return std::max(thresholds[i].blurSize, 1); };
+    std::vector<FusedRange> ranges;
+
+    for (int i = 0; i < count; i++) {
+      // Skip thresholds that were already done with an earlier one's blur.
+      bool done = false;
+      for (int j = 0; j < i && !done; j++) {
+        done = blurOf(j) == blurOf(i);
+      }
+      if (done) {
+        continue;
+      }
+
+      if (method == THRESHOLD_FUSED) {
+        // Every range with this blur is checked in the same pass.
+        CV_Assert(src.type() == CV_8UC3);
+        ranges.clear();
+        for (int j = i; j < count; j++) {
+          if (blurOf(j) == blurOf(i)) {
+            masks[j].create(src.size(), CV_8UC1);
+            ranges.push_back({thresholds[j].low, thresholds[j].high, &masks[j], nullptr});
+          }
+        }
+        fusedThresholdRows(src, blurOf(i), ranges.data(), ranges.size(), 0, src.rows, sums, columns);
+        continue;
+      }
+
+      // Mean blur over the image to remove noise, shared by every threshold with the same blur size.
+      cv::blur(src, blur, cv::Size(blurOf(i), blurOf(i)));
+
+      if (method != THRESHOLD_TABLE) {
+        cv::cvtColor(blur, hsv, cv::COLOR_BGR2HSV);
+      }
+
+      for (int j = i; j < count; j++) {
+        if (blurOf(j) != blurOf(i)) {
+          continue;
+        }
+
+        if (method == THRESHOLD_TABLE) {
+          currentTable(thresholds[j], tables[j]).apply(blur, masks[j]);
+        } else {
+          rangeThreshold(hsv, masks[j], thresholds[j], upper);
+        }
+      }
+    }
+
+    // Each mask gets its own morphology so the engines are not rebuilt every frame.
+    for (int i = 0; i < count; i++) {
+      applyMorphology(openMorphologies[i], cv::MORPH_OPEN, thresholds[i].openMatrix, masks[i], open);
+      applyMorphology(closeMorphologies[i], cv::MORPH_CLOSE, thresholds[i].closeMatrix, open, dst[i]);
+    }
+  }
+
+  void thresholdImage(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold, int method) {
+    // Each thread keeps its own context, so callers still using this
+    // reuse the buffers between calls too.
+    thread_local rv::ThresholdContext context;
+    context.method = method;
+    context.apply(src, dst, threshold);
+  }
+
+  void ParallelThresholdContext::apply(const cv::Mat& src, cv::Mat& dst, const rv::Threshold& threshold) {
+    // Rows at the edge of a band can be wrong after each morphological
+    // operation by up to the height of its kernel, since the band can't
+    // see the rows past it. Opening and closing are two operations each.
+    auto kernelRows = [](const cv::Mat& kernel) { return kernel.empty() ? 3 : kernel.rows; };
+    const int halo = 2 * (kernelRows(threshold.openMatrix) - 1) + 2 * (kernelRows(threshold.closeMatrix) - 1);
+
+    // Bands thinner than the halo would mostly be redoing thier neighbours' work.
+    const int bands = std::max(1, std::min(cv::getNumThreads(), src.rows / std::max(halo, 1)));
+    if (contexts.size() < bands) {
+      contexts.resize(bands);
+      masks.resize(bands);
+    }
+
+    dst.create(src.size(), CV_8UC1);
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+      for (int i = range.start; i < range.end; i++) {
+        const int start = src.rows * i / bands;
+        const int end = src.rows * (i + 1) / bands;
+        const int haloStart = std::max(start - halo, 0);
+        const int haloEnd = std::min(end + halo, src.rows);
+
+        contexts[i].method = method;
+        contexts[i].apply(src.rowRange(haloStart, haloEnd), masks[i], threshold);
+
+        // Only the rows without any halo error are kept.
+        cv::Mat band = dst.rowRange(start, end);
+        masks[i].rowRange(start - haloStart, end - haloStart).copyTo(band);
+      }
+    }, bands);
   }
 
   bool extractImagesFromDirectory(std::string filepath, std::vector<cv::Mat>& images) {
     // Double check that the directory exists.
-    if (std::filesystem::exists(filepath)) {
+    if (!std::filesystem::exists(filepath)) {
       return false;
     }
 
@@ -0,0 +1,278 @@
+#include "rambunctionVision/morphology.hpp"
+
+#include <vector>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+  // Combines two mask values for either an erosion (and) or dilation (or).
+  template<bool Erode>
+  inline uchar combine(uchar a, uchar b) {
+    return Erode ? (a & b) : (a | b);
+  }
+
+  // van Herk/Gil-Werman prefix and suffix of `line` in blocks of `size`.
+  // The window [x, x + size) is then combine(suffix[x], prefix[x + size - 1]).
+  template<bool Erode>
+  void blockScan(const uchar* line, uchar* prefix, uchar* suffix, int length, int size) {
+    for (int start = 0; start < length; start += size) {
+      int end = std::min(start + size, length);
+
+      prefix[start] = line[start];
+      for (int i = start + 1; i < end; i++) {
+        prefix[i] = combine<Erode>(prefix[i - 1], line[i]);
+      }
+
+      suffix[end - 1] = line[end - 1];
+      for (int i = end - 2; i >= start; i--) {
+        suffix[i] = combine<Erode>(suffix[i + 1], line[i]);
+      }
+    }
+  }
+
+  // A view of the top left of a scratch buffer. The buffer only grows when
+  // an image is bigger than any before it, so regions of diffrent sizes
+  // share it instead of each reallocating it.
+  cv::Mat scratch(cv::Mat& buffer, cv::Size size, int type) {
+    if (buffer.type() != type || buffer.rows < size.height || buffer.cols < size.width) {
+      buffer.create(std::max(buffer.rows, size.height), std::max(buffer.cols, size.width), type);
+    }
+    return buffer(cv::Rect(0, 0, size.width, size.height));
+  }
+}
+
+namespace rv {
+  void BinaryMorphology::setKernel(const cv::Mat& newKernel, cv::Point newAnchor) {
+    // Like OpenCV, an empty kernel means a 3x3 rectangle.
+    if (newKernel.empty()) {
+      kernel = cv::Mat(3, 3, CV_8UC1, cv::Scalar(1));
+    } else {
+      newKernel.convertTo(kernel, CV_8U);
+    }
+
+    anchor.x = newAnchor.x < 0 ? kernel.cols / 2 : newAnchor.x;
+    anchor.y = newAnchor.y < 0 ? kernel.rows / 2 : newAnchor.y;
+
+    // Break each row of the kernel into runs of ones.
+    chords.clear();
+    int elements = 0;
+    for (int y = 0; y < kernel.rows; y++) {
+      const uchar* row = kernel.ptr<uchar>(y);
+      for (int x = 0; x < kernel.cols; x++) {
+        if (!row[x]) {
+          continue;
+        }
+
+        int start = x;
+        while (x < kernel.cols && row[x]) {
+          x++;
+        }
+        chords.push_back({start - anchor.x, y - anchor.y, x - start});
+        elements += x - start;
+      }
+    }
+
+    isRect = elements == kernel.rows * kernel.cols;
+
+    // Small kernels are left to OpenCV's vectorized filters.
+    isPreferred = isRect ? std::max(kernel.rows, kernel.cols) >= 7 : elements > 9;
+  }
+
+  bool BinaryMorphology::sameKernel(const cv::Mat& other) const {
+    if (other.empty() || other.type() != CV_8UC1 || other.size() != kernel.size()) {
+      return false;
+    }
+
+    for (int y = 0; y < kernel.rows; y++) {
+      if (std::memcmp(kernel.ptr<uchar>(y), other.ptr<uchar>(y), kernel.cols) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void BinaryMorphology::erode(const cv::Mat& src, cv::Mat& dst) {
+    CV_Assert(src.type() == CV_8UC1);
+    if (isRect) {
+      rectMorphology<true>(src, dst);
+    } else {
+      chordMorphology<true>(src, dst);
+    }
+  }
+
+  void BinaryMorphology::dilate(const cv::Mat& src, cv::Mat& dst) {
+    CV_Assert(src.type() == CV_8UC1);
+    if (isRect) {
+      rectMorphology<false>(src, dst);
+    } else {
+      chordMorphology<false>(src, dst);
+    }
+  }
+
+  void BinaryMorphology::apply(int op, const cv::Mat& src, cv::Mat& dst) {
+    switch (op) {
+      case cv::MORPH_ERODE:
+        erode(src, dst);
+        break;
+      case cv::MORPH_DILATE:
+        dilate(src, dst);
+        break;
+      case cv::MORPH_OPEN: {
+        cv::Mat eroded = scratch(between, src.size(), CV_8UC1);
+        erode(src, eroded);
+        dilate(eroded, dst);
+        break;
+      }
+      case cv::MORPH_CLOSE: {
+        cv::Mat dilated = scratch(between, src.size(), CV_8UC1);
+        dilate(src, dilated);
+        erode(dilated, dst);
+        break;
+      }
+      default:
+        CV_Assert(false && "Unsupported morphology operation");
+    }
+  }
+
+  template<bool Erode>
+  void BinaryMorphology::rectMorphology(const cv::Mat& src, cv::Mat& dst) {
+    // Pixels outside the image never change the result.
+    const uchar border = Erode ? 255 : 0;
+    const int width = kernel.cols, height = kernel.rows;
+
+    // Horizontal pass, one row at a time through padded line buffers.
+    const int length = src.cols + width - 1;
+    line.assign(length, border);
+    linePrefix.resize(length);
+    lineSuffix.resize(length);
+    cv::Mat horizontalPass = scratch(horizontal, src.size(), CV_8UC1);
+
+    for (int y = 0; y < src.rows; y++) {
+      std::memcpy(line.data() + anchor.x, src.ptr<uchar>(y), src.cols);
+      blockScan<Erode>(line.data(), linePrefix.data(), lineSuffix.data(), length, width);
+
+      uchar* out = horizontalPass.ptr<uchar>(y);
+      for (int x = 0; x < src.cols; x++) {
+        out[x] = combine<Erode>(lineSuffix[x], linePrefix[x + width - 1]);
+      }
+    }
+
+    // Vertical pass, the same scan but with whole rows at a time. Each
+    // inner loop is over a contiguous row so it can be vectorized.
+    const int rows = src.rows + height - 1;
+    cv::Mat prefixRows = scratch(prefix, cv::Size(src.cols, rows), CV_8UC1);
+    cv::Mat suffixRows = scratch(suffix, cv::Size(src.cols, rows), CV_8UC1);
+    borderRow.assign(src.cols, border);
+
+    auto paddedRow = [&](int y) {
+      int row = y - anchor.y;
+      return (row >= 0 && row < src.rows) ? horizontalPass.ptr<uchar>(row) : borderRow.data();
+    };
+
+    for (int start = 0; start < rows; start += height) {
+      int end = std::min(start + height, rows);
+
+      std::memcpy(prefixRows.ptr<uchar>(start), paddedRow(start), src.cols);
+      for (int y = start + 1; y < end; y++) {
+        const uchar* previous = prefixRows.ptr<uchar>(y - 1);
+        const uchar* current = paddedRow(y);
+        uchar* out = prefixRows.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; x++) {
+          out[x] = combine<Erode>(previous[x], current[x]);
+        }
+      }
+
+      std::memcpy(suffixRows.ptr<uchar>(end - 1), paddedRow(end - 1), src.cols);
+      for (int y = end - 2; y >= start; y--) {
+        const uchar* next = suffixRows.ptr<uchar>(y + 1);
+        const uchar* current = paddedRow(y);
+        uchar* out = suffixRows.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; x++) {
+          out[x] = combine<Erode>(next[x], current[x]);
+        }
+      }
+    }
+
+    dst.create(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; y++) {
+      const uchar* top = suffixRows.ptr<uchar>(y);
+      const uchar* bottom = prefixRows.ptr<uchar>(y + height - 1);
+      uchar* out = dst.ptr<uchar>(y);
+      for (int x = 0; x < src.cols; x++) {
+        out[x] = combine<Erode>(top[x], bottom[x]);
+      }
+    }
+  }
+
+  template<bool Erode>
+  void BinaryMorphology::chordMorphology(const cv::Mat& src, cv::Mat& dst) {
+    // A dilation is an erosion of the inverted mask, so instead of runs of
+    // ones, the runs of zeros are used and the result is inverted.
+    const uchar active = Erode ? 255 : 0;
+    const uchar pass = Erode ? 255 : 0;
+    const uchar fail = Erode ? 0 : 255;
+
+    // Runs that reach the edge of the image never end, since
+    // pixels outside the image are ignored.
+    const ushort endless = std::numeric_limits<ushort>::max();
+
+    // For every pixel, find how many pixels to its right (including
+    // itself) are active before the run is broken.
+    cv::Mat runLengths = scratch(runs, src.size(), CV_16UC1);
+    for (int y = 0; y < src.rows; y++) {
+      const uchar* in = src.ptr<uchar>(y);
+      ushort* run = runLengths.ptr<ushort>(y);
+
+      ushort length = endless;
+      for (int x = src.cols - 1; x >= 0; x--) {
+        length = (in[x] == active) ? ((length == endless) ? endless : length + 1) : 0;
+        run[x] = length;
+      }
+    }
+
+    dst.create(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; y++) {
+      uchar* out = dst.ptr<uchar>(y);
+      std::memset(out, pass, src.cols);
+
+      for (auto& chord : chords) {
+        // Chords falling outside the image always fit.
+        int row = y + chord.dy;
+        if (row < 0 || row >= src.rows) {
+          continue;
+        }
+        const ushort* run = runLengths.ptr<ushort>(row);
+
+        // The range of x where the chord lies fully in the image.
+        int first = std::clamp(-chord.dx, 0, src.cols);
+        int last = std::clamp(src.cols - chord.dx - chord.length + 1, first, src.cols);
+
+        for (int x = first; x < last; x++) {
+          if (run[x + chord.dx] < chord.length) {
+            out[x] = fail;
+          }
+        }
+
+        // Near the edges only the part of the chord inside the image counts.
+        auto clipped = [&](int x) {
+          int start = std::max(x + chord.dx, 0);
+          int end = std::min(x + chord.dx + chord.length, src.cols);
+          if (start < end && run[start] < end - start) {
+            out[x] = fail;
+          }
+        };
+
+        for (int x = 0; x < first; x++) {
+          clipped(x);
+        }
+        for (int x = last; x < src.cols; x++) {
+          clipped(x);
+        }
+      }
+    }
+  }
+}
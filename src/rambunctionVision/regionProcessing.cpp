@@ -0,0 +1,225 @@
+#include "rambunctionVision/regionProcessing.hpp"
+
+#include <vector>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+  // The most times the frame is halved for a coarse search. Any more and
+  // balls and targets are too small to be found in the small frame.
+  const int maxPyramidLevels = 2;
+
+  // The pixels covered by a circle.
+  cv::Rect circleRect(const rv::Circle& circle) {
+    cv::Point topLeft(std::floor(circle.center.x - circle.radius), std::floor(circle.center.y - circle.radius));
+    cv::Point bottomRight(std::ceil(circle.center.x + circle.radius) + 1, std::ceil(circle.center.y + circle.radius) + 1);
+    return cv::Rect(topLeft, bottomRight);
+  }
+}
+
+namespace rv {
+  void mergeRegions(std::vector<cv::Rect>& regions) {
+    // Merging two regions can make the result overlap a third, so keep
+    // going until a full pass merges nothing.
+    bool merged = true;
+    while (merged) {
+      merged = false;
+      for (int i = 0; i < regions.size(); i++) {
+        for (int j = i + 1; j < regions.size(); j++) {
+          if ((regions[i] & regions[j]).area() > 0) {
+            regions[i] |= regions[j];
+            regions.erase(regions.begin() + j);
+            merged = true;
+            j = i;
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::BallPose>& poses) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(poses.size());
+    for (auto& pose : poses) {
+      rects.push_back(circleRect(pose.circleMatch.circle));
+    }
+    return rects;
+  }
+
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::TargetPose>& poses) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(poses.size());
+    for (auto& pose : poses) {
+      if (!pose.match.shape.empty()) {
+        rects.push_back(cv::boundingRect(pose.match.shape));
+      }
+    }
+    return rects;
+  }
+
+  std::vector<cv::Rect> boundingRects(const std::vector<rv::IndexedCircleMatch>& circles) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(circles.size());
+    for (auto& match : circles) {
+      rects.push_back(circleRect(match.circle));
+    }
+    return rects;
+  }
+
+  std::vector<cv::Rect> boundingRects(const std::vector<std::vector<cv::Point>>& contours, const std::vector<rv::IndexedTargetMatch>& matches) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(matches.size());
+    for (auto& match : matches) {
+      rects.push_back(cv::boundingRect(contours[match.contour]));
+    }
+    return rects;
+  }
+
+  std::vector<cv::Rect> boundingRects(const rv::ContourArena& contours, const std::vector<rv::IndexedTargetMatch>& matches) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(matches.size());
+    for (auto& match : matches) {
+      rects.push_back(cv::boundingRect(contours.contour(match.contour)));
+    }
+    return rects;
+  }
+
+  std::vector<cv::Rect> boundingRects(std::vector<rv::ContourFeatures>& features, const std::vector<rv::IndexedTargetMatch>& matches) {
+    std::vector<cv::Rect> rects;
+    rects.reserve(matches.size());
+    for (auto& match : matches) {
+      rects.push_back(features[match.contour].boundingRect());
+    }
+    return rects;
+  }
+
+  RegionSearch::RegionSearch(cv::Size frameSize, int method, int rescanInterval, int padding, int pyramidLevels)
+    : context(frameSize, method), rescanInterval(rescanInterval), padding(padding),
+      pyramidLevels(std::clamp(pyramidLevels, 0, maxPyramidLevels)), coarseContext(method) {
+    if (this->pyramidLevels > 0) {
+      coarseContext.reserve(cv::Size(frameSize.width >> this->pyramidLevels, frameSize.height >> this->pyramidLevels));
+    }
+  }
+
+  void RegionSearch::threshold(const cv::Mat& frame, cv::Mat& mask, const rv::Threshold& threshold) {
+    const cv::Rect fullFrame(cv::Point(0, 0), frame.size());
+    searchRegions.clear();
+
+    // Search the full frame when asked to, or when there is nothing to follow.
+    if (rescanInterval <= 0 || detections.empty() || framesSinceScan >= rescanInterval) {
+      if (pyramidLevels > 0) {
+        coarseSearch(frame, threshold);
+      } else {
+        searchRegions.push_back(fullFrame);
+      }
+      framesSinceScan = 0;
+    } else {
+      for (auto& detection : detections) {
+        cv::Rect region(detection.x - padding, detection.y - padding, detection.width + 2 * padding, detection.height + 2 * padding);
+        region &= fullFrame;
+        if (!region.empty()) {
+          searchRegions.push_back(region);
+        }
+      }
+      mergeRegions(searchRegions);
+      framesSinceScan++;
+
+      if (searchRegions.empty()) {
+        searchRegions.push_back(fullFrame);
+        framesSinceScan = 0;
+      }
+    }
+
+    // Each region is written directly into the full frame mask, and the
+    // context's buffers are kept at the full frame size so regions of any
+    // size reuse them. Both cv::blur (the legacy and table methods) and the
+    // fused kernel (through locateROI) read pixels past the edges of the
+    // region from the frame. The morphology sees only the region's own mask,
+    // with nothing past its edges, so the only diffrence from thresholding
+    // the full frame is the morphology along the edges of the region.
+    mask.create(frame.size(), CV_8UC1);
+    for (auto& region : searchRegions) {
+      cv::Mat regionMask = mask(region);
+      context.apply(frame(region), regionMask, threshold);
+    }
+  }
+
+  void RegionSearch::coarseSearch(const cv::Mat& frame, const rv::Threshold& threshold) {
+    // The levels are public, so they're clamped again in case they were changed.
+    pyramidLevels = std::clamp(pyramidLevels, 0, maxPyramidLevels);
+    const int scale = 1 << pyramidLevels;
+    const cv::Rect fullFrame(cv::Point(0, 0), frame.size());
+
+    // Area interpolation averages each block of pixels, so it also acts
+    // as part of the blur.
+    cv::resize(frame, coarseFrame, cv::Size(frame.cols / scale, frame.rows / scale), 0, 0, cv::INTER_AREA);
+
+    // Shrink the blur and kernels to match the frame. The table only depends
+    // on the colors so it can be shared.
+    auto scaleKernel = [&](const cv::Mat& kernel, cv::Mat& scaled) {
+      if (kernel.empty()) {
+        scaled = cv::Mat();
+        return;
+      }
+      cv::Size size(std::max(kernel.cols / scale, 1) | 1, std::max(kernel.rows / scale, 1) | 1);
+      cv::resize(kernel, scaled, size, 0, 0, cv::INTER_NEAREST);
+    };
+
+    coarseThreshold.low = threshold.low;
+    coarseThreshold.high = threshold.high;
+    coarseThreshold.table = threshold.table;
+    coarseThreshold.blurSize = std::max(threshold.blurSize / scale, 1);
+    scaleKernel(threshold.openMatrix, coarseThreshold.openMatrix);
+    scaleKernel(threshold.closeMatrix, coarseThreshold.closeMatrix);
+
+    coarseContext.method = context.method;
+    coarseContext.apply(coarseFrame, coarseMask, coarseThreshold);
+    coarseContours.find(coarseMask);
+
+    // Search each candidate again at full resolution. One extra pyramid
+    // pixel is added to each side to cover any rounding in the small frame.
+    for (int i = 0; i < coarseContours.size(); i++) {
+      cv::Rect rect = cv::boundingRect(coarseContours.contour(i));
+      cv::Rect region((rect.x - 1) * scale - padding, (rect.y - 1) * scale - padding,
+                      (rect.width + 2) * scale + 2 * padding, (rect.height + 2) * scale + 2 * padding);
+      region &= fullFrame;
+      if (!region.empty()) {
+        searchRegions.push_back(region);
+      }
+    }
+    mergeRegions(searchRegions);
+  }
+
+  void RegionSearch::findContours(const cv::Mat& mask, std::vector<std::vector<cv::Point>>& contours) {
+    contours.clear();
+    for (auto& region : searchRegions) {
+      // Offset the contours so they are in full frame coordinates.
+      cv::findContours(mask(region), regionContours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE, region.tl());
+      contours.insert(contours.end(), std::make_move_iterator(regionContours.begin()), std::make_move_iterator(regionContours.end()));
+    }
+  }
+
+  void RegionSearch::findContours(const cv::Mat& mask, rv::ContourArena& contours) {
+    contours.clear();
+    for (auto& region : searchRegions) {
+      // Offset the contours so they are in full frame coordinates.
+      contours.add(mask(region), region.tl());
+    }
+  }
+
+  void RegionSearch::findBlobs(const cv::Mat& mask, std::vector<rv::Blob>& blobs) {
+    blobs.clear();
+    for (auto& region : searchRegions) {
+      blobFinder.find(mask(region), regionBlobs, region.tl());
+      blobs.insert(blobs.end(), regionBlobs.begin(), regionBlobs.end());
+    }
+  }
+
+  void RegionSearch::update(const std::vector<cv::Rect>& newDetections) {
+    detections = newDetections;
+  }
+}
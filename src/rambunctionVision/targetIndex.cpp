@@ -0,0 +1,234 @@
+#include "rambunctionVision/targetIndex.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+  // Targets in a node before it's split.
+  const int leafSize = 4;
+
+  // Nodes are split at the median, so the tree is at most about
+  // log2(targets / leafSize) + 1 deep, and a depth first search never has
+  // more than one node waiting per level. This covers far more targets
+  // than could ever fit in memory.
+  const int maxStack = 64;
+
+  // Which moments can be compared.
+  int comparableMask(const rv::HuMoments& moments) {
+    int mask = 0;
+    for (int i = 0; i < 7; i++) {
+      if (moments.values[i] != 0) {
+        mask |= 1 << i;
+      }
+    }
+    return mask;
+  }
+
+  // Looks up each contour in the index, with featuresAt(i, own) giving
+  // the features of the i-th contour, either shared ones or kept in own.
+  template<typename FeaturesAt>
+  void findTargetsIn(int count, const FeaturesAt& featuresAt, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    // Each contour gets a slot, and the ones left without a target are
+    // removed after, so the order doesn't depend on the threads.
+    matches.assign(count, {-1, -1, 0, {}});
+    rv::parallelForEach(count, [&](int i) {
+      rv::ContourFeatures ownFeatures;
+      rv::ContourFeatures& features = featuresAt(i, ownFeatures);
+
+      // Make sure the contoyr isn't too small, first by its bounding
+      // rect, then by the area from its moments.
+      if (features.boundingRect().area() < minArea || std::abs(features.moments().m00) < minArea) {
+        return;
+      }
+
+      double bestMatch;
+      int matchingTarget = index.nearest(features.huMoments(), maxMatch, bestMatch);
+      if (matchingTarget >= 0) {
+        matches[i] = {i, matchingTarget, bestMatch, {}};
+      }
+    });
+
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [](const rv::IndexedTargetMatch& match) {
+      return match.target < 0;
+    }), matches.end());
+  }
+}
+
+namespace rv {
+  void TargetIndex::build(const std::vector<rv::Target>& targets) {
+    moments.clear();
+    order.clear();
+    groups.clear();
+
+    // Use each target's cached moments, only finding them
+    // here if they are out of date.
+    std::vector<int> masks;
+    for (auto& target : targets) {
+      if (target.cacheBuilt()) {
+        moments.push_back(target.huMoments);
+      } else if (!target.shape.empty()) {
+        moments.push_back(rv::HuMoments(cv::moments(target.shape)));
+      } else {
+        // Empty targets never match anything.
+        moments.push_back(rv::HuMoments());
+        masks.push_back(-1);
+        continue;
+      }
+      masks.push_back(comparableMask(moments.back()));
+    }
+
+    // Sort the targets by group, keeping them in order within each one.
+    for (int i = 0; i < masks.size(); i++) {
+      if (masks[i] >= 0) {
+        order.push_back(i);
+      }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return masks[a] < masks[b];
+    });
+
+    for (int start = 0; start < order.size();) {
+      int end = start;
+      while (end < order.size() && masks[order[end]] == masks[order[start]]) {
+        end++;
+      }
+
+      groups.push_back({masks[order[start]], {}});
+      buildNode(groups.back(), start, end);
+      start = end;
+    }
+  }
+
+  int TargetIndex::buildNode(rv::TargetIndex::Group& group, int start, int end) {
+    Node node;
+    node.start = start;
+    node.end = end;
+    node.low = moments[order[start]].values;
+    node.high = moments[order[start]].values;
+    for (int i = start + 1; i < end; i++) {
+      for (int d = 0; d < 7; d++) {
+        node.low[d] = std::min(node.low[d], moments[order[i]].values[d]);
+        node.high[d] = std::max(node.high[d], moments[order[i]].values[d]);
+      }
+    }
+
+    int index = group.nodes.size();
+    group.nodes.push_back(node);
+    if (end - start <= leafSize) {
+      return index;
+    }
+
+    // Split the widest moment at its median.
+    int axis = 0;
+    for (int d = 1; d < 7; d++) {
+      if (node.high[d] - node.low[d] > node.high[axis] - node.low[axis]) {
+        axis = d;
+      }
+    }
+    if (node.high[axis] == node.low[axis]) {
+      return index;
+    }
+
+    int middle = (start + end) / 2;
+    std::nth_element(order.begin() + start, order.begin() + middle, order.begin() + end, [&](int a, int b) {
+      return moments[a].values[axis] < moments[b].values[axis];
+    });
+
+    // Pushing children can move the nodes, so they're set by index.
+    int left = buildNode(group, start, middle);
+    int right = buildNode(group, middle, end);
+    group.nodes[index].left = left;
+    group.nodes[index].right = right;
+    return index;
+  }
+
+  int TargetIndex::nearest(const rv::HuMoments& shape, double maxMatch, double& match) const {
+    const int shapeMask = comparableMask(shape);
+    int best = -1;
+    double bestMatch = maxMatch;
+
+    // Keeps the first target on a tie, like a linear scan would.
+    auto consider = [&](int target, double value) {
+      if (value < bestMatch || (value == bestMatch && best >= 0 && target < best)) {
+        best = target;
+        bestMatch = value;
+      }
+    };
+
+    // Kept on the stack, since this runs for every contour on every thread.
+    int stack[maxStack];
+    for (auto& group : groups) {
+      const int mask = group.mask & shapeMask;
+
+      // A shape with no usable moments can't match one that has some.
+      if ((group.mask == 0) != (shapeMask == 0)) {
+        continue;
+      }
+
+      // The closest anything in a node could be, counting
+      // only the moments both shapes can compare.
+      auto lowerBound = [&](const Node& node) {
+        double bound = 0;
+        for (int d = 0; d < 7; d++) {
+          if (mask & (1 << d)) {
+            bound += std::max({node.low[d] - shape.values[d], shape.values[d] - node.high[d], 0.0});
+          }
+        }
+        return bound;
+      };
+
+      int top = 0;
+      stack[top++] = 0;
+      while (top > 0) {
+        const Node& node = group.nodes[stack[--top]];
+        if (lowerBound(node) > bestMatch) {
+          continue;
+        }
+
+        if (node.left < 0) {
+          for (int i = node.start; i < node.end; i++) {
+            consider(order[i], shape.compare(moments[order[i]]));
+          }
+          continue;
+        }
+
+        // Visit the closer child first so the bound tightens sooner.
+        int near = node.left, far = node.right;
+        if (lowerBound(group.nodes[far]) < lowerBound(group.nodes[near])) {
+          std::swap(near, far);
+        }
+        CV_DbgAssert(top + 2 <= maxStack);
+        stack[top++] = far;
+        stack[top++] = near;
+      }
+    }
+
+    match = bestMatch;
+    return best;
+  }
+
+  void findTargets(const std::vector<std::vector<cv::Point>>& contours, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(contours.size(), [&](int i, rv::ContourFeatures& own) -> rv::ContourFeatures& {
+      own.reset(cv::Mat(contours[i]));
+      return own;
+    }, index, minArea, maxMatch, matches);
+  }
+
+  void findTargets(const rv::ContourArena& contours, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(contours.size(), [&](int i, rv::ContourFeatures& own) -> rv::ContourFeatures& {
+      own.reset(contours.contour(i));
+      return own;
+    }, index, minArea, maxMatch, matches);
+  }
+
+  void findTargets(std::vector<rv::ContourFeatures>& features, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    findTargetsIn(features.size(), [&](int i, rv::ContourFeatures&) -> rv::ContourFeatures& {
+      return features[i];
+    }, index, minArea, maxMatch, matches);
+  }
+}
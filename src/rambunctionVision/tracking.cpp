@@ -0,0 +1,292 @@
+#include "rambunctionVision/tracking.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+namespace {
+  // The variance of a new track's velocity, which is unknown until
+  // it's been seen a second time.
+  const double initialVelocityVariance = 1e4;
+
+  // Sets up a filter to move each position by its velocity over dt. The
+  // acceleration is treated as white noise, which for each axis adds
+  // processNoise * [dt^3/3, dt^2/2; dt^2/2, dt] to the covariance.
+  void setTimeStep(cv::KalmanFilter& filter, double dt, double processNoise) {
+    filter.transitionMatrix = cv::Mat::eye(6, 6, CV_64F);
+    filter.processNoiseCov = cv::Mat::zeros(6, 6, CV_64F);
+    for (int axis = 0; axis < 3; axis++) {
+      filter.transitionMatrix.at<double>(axis, axis + 3) = dt;
+      filter.processNoiseCov.at<double>(axis, axis) = processNoise * dt * dt * dt / 3;
+      filter.processNoiseCov.at<double>(axis, axis + 3) = processNoise * dt * dt / 2;
+      filter.processNoiseCov.at<double>(axis + 3, axis) = processNoise * dt * dt / 2;
+      filter.processNoiseCov.at<double>(axis + 3, axis + 3) = processNoise * dt;
+    }
+  }
+
+  // Copies the filter's state out to the track.
+  void readState(rv::Track& track, double dt) {
+    const cv::Mat& state = track.filter.statePost;
+    track.position = cv::Point3d(state.at<double>(0), state.at<double>(1), state.at<double>(2));
+    track.velocity = cv::Point3d(state.at<double>(3), state.at<double>(4), state.at<double>(5));
+    track.predicted = track.position + track.velocity * dt;
+  }
+
+  // The intersection over union of two rectangles.
+  double overlap(const cv::Rect& a, const cv::Rect& b) {
+    double intersection = (a & b).area();
+    double total = a.area() + b.area() - intersection;
+    return total > 0 ? intersection / total : 0;
+  }
+
+  // Twice the signed area of a polygon, positive or negative
+  // depending on which way around its points go.
+  double signedArea(const std::vector<cv::Point2f>& points) {
+    double area = 0;
+    for (int i = 0; i < points.size(); i++) {
+      const cv::Point2f& a = points[i];
+      const cv::Point2f& b = points[(i + 1) % points.size()];
+      area += a.x * b.y - b.x * a.y;
+    }
+    return area;
+  }
+
+  // Moves each of last frame's points by the offset and snaps it to the
+  // closest point of the contour. Fails if any moves further than
+  // maxDistance, or if the snapped points no longer make the same polygon:
+  // two landing on the same contour point, being out of order along the
+  // contour, or going around the other way.
+  bool snapPoints(const std::vector<cv::Point2f>& points, cv::Point2f offset, const cv::Mat& contour, double maxDistance,
+                  std::vector<int>& indices, std::vector<cv::Point2f>& snapped) {
+    const cv::Point* contourPoints = contour.ptr<cv::Point>();
+    const int count = points.size();
+    indices.resize(count);
+    snapped.resize(count);
+    for (int i = 0; i < count; i++) {
+      cv::Point2f expected = points[i] + offset;
+      double best = DBL_MAX;
+      for (int p = 0; p < contour.rows; p++) {
+        cv::Point2f difference = cv::Point2f(contourPoints[p]) - expected;
+        double distance = difference.dot(difference);
+        if (distance < best) {
+          best = distance;
+          indices[i] = p;
+        }
+      }
+      if (best > maxDistance * maxDistance) {
+        return false;
+      }
+      snapped[i] = contourPoints[indices[i]];
+    }
+
+    // Going around the points in order, the contour index only wraps back
+    // once if they go along the contour, or every step but one if they go
+    // against it. Anything else means points were swapped or merged.
+    int wraps = 0;
+    for (int i = 0; i < count; i++) {
+      int next = indices[(i + 1) % count];
+      if (next == indices[i]) {
+        return false;
+      }
+      wraps += next < indices[i];
+    }
+    if (count > 2 && wraps != 1 && wraps != count - 1) {
+      return false;
+    }
+
+    // The polygon must still go around the same way as last frame's.
+    return count < 3 || (signedArea(points) > 0) == (signedArea(snapped) > 0);
+  }
+}
+
+namespace rv {
+  void Tracker::update(const std::vector<cv::Point3d>& positions, const std::vector<cv::Rect>& bounds, double dt) {
+    CV_Assert(positions.size() == bounds.size());
+
+    // Move every track forward to this frame, and find each
+    // detection close enough to a track's prediction.
+    candidates.clear();
+    for (int t = 0; t < active.size(); t++) {
+      rv::Track& track = active[t];
+      track.detection = -1;
+      setTimeStep(track.filter, dt, processNoise);
+      const cv::Mat& state = track.filter.predict();
+      cv::Point3d prediction(state.at<double>(0), state.at<double>(1), state.at<double>(2));
+
+      for (int d = 0; d < positions.size(); d++) {
+        cv::Point3d offset = positions[d] - prediction;
+        double distance = std::sqrt(offset.dot(offset));
+        if (distance <= maxDistance) {
+          candidates.push_back({distance, t, d});
+        }
+      }
+    }
+
+    // Match the closest pairs first, so each track and detection is used
+    // at most once. Ties go to the oldest track and first detection.
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+      if (a.distance != b.distance) {
+        return a.distance < b.distance;
+      }
+      return a.track != b.track ? a.track < b.track : a.detection < b.detection;
+    });
+
+    used.assign(positions.size(), false);
+    for (auto& candidate : candidates) {
+      rv::Track& track = active[candidate.track];
+      if (track.detection >= 0 || used[candidate.detection]) {
+        continue;
+      }
+      track.detection = candidate.detection;
+      used[candidate.detection] = true;
+    }
+
+    // Correct the matched tracks, and let the rest coast on thier prediction.
+    for (auto& track : active) {
+      if (track.detection >= 0) {
+        const cv::Point3d& position = positions[track.detection];
+        track.filter.correct(cv::Mat(cv::Matx31d(position.x, position.y, position.z)));
+        track.bounds = bounds[track.detection];
+        track.hits++;
+        track.misses = 0;
+      } else {
+        track.misses++;
+      }
+      track.confirmed = track.confirmed || track.hits >= minHits;
+      readState(track, dt);
+    }
+
+    // Drop tracks that haven't been seen in too long.
+    active.erase(std::remove_if(active.begin(), active.end(), [&](const rv::Track& track) {
+      return track.misses > maxMisses;
+    }), active.end());
+
+    // Every detection left over starts a new track.
+    for (int d = 0; d < positions.size(); d++) {
+      if (!used[d]) {
+        startTrack(positions[d], bounds[d], d);
+      }
+    }
+  }
+
+  void Tracker::startTrack(const cv::Point3d& position, const cv::Rect& bounds, int detection) {
+    rv::Track track;
+    track.id = nextId++;
+    track.bounds = bounds;
+    track.detection = detection;
+    track.hits = 1;
+    track.misses = 0;
+    track.confirmed = minHits <= 1;
+
+    // Only the position is measured.
+    track.filter.init(6, 3, 0, CV_64F);
+    track.filter.measurementMatrix = cv::Mat::eye(3, 6, CV_64F);
+    track.filter.measurementNoiseCov = cv::Mat::eye(3, 3, CV_64F) * measurementNoise;
+
+    // Start still, with the position as certain as a measurement
+    // and the velocity barely known.
+    track.filter.statePost = cv::Mat::zeros(6, 1, CV_64F);
+    track.filter.statePost.at<double>(0) = position.x;
+    track.filter.statePost.at<double>(1) = position.y;
+    track.filter.statePost.at<double>(2) = position.z;
+    track.filter.errorCovPost = cv::Mat::zeros(6, 6, CV_64F);
+    for (int axis = 0; axis < 3; axis++) {
+      track.filter.errorCovPost.at<double>(axis, axis) = measurementNoise;
+      track.filter.errorCovPost.at<double>(axis + 3, axis + 3) = initialVelocityVariance;
+    }
+
+    readState(track, 0);
+    active.push_back(std::move(track));
+  }
+
+  std::vector<cv::Rect> Tracker::regions() const {
+    std::vector<cv::Rect> rects;
+    rects.reserve(active.size());
+    for (auto& track : active) {
+      rects.push_back(track.bounds);
+    }
+    return rects;
+  }
+
+  void TargetCache::find(std::vector<rv::ContourFeatures>& features, const std::vector<rv::Target>& targets, const rv::TargetIndex& index, double minArea, double maxMatch, std::vector<rv::IndexedTargetMatch>& matches) {
+    matches.clear();
+    fresh.clear();
+    claimed.assign(previous.size(), false);
+
+    for (int i = 0; i < features.size(); i++) {
+      // Make sure the contour isn't too small, first by its bounding
+      // rect, then by the area from its moments, whether it's reused or not.
+      rv::ContourFeatures& contour = features[i];
+      const cv::Rect& bounds = contour.boundingRect();
+      if (bounds.area() < minArea || std::abs(contour.moments().m00) < minArea) {
+        continue;
+      }
+
+      // The previous match this contour overlaps the most.
+      int best = -1;
+      double bestOverlap = minOverlap;
+      for (int e = 0; e < previous.size(); e++) {
+        double value = overlap(bounds, previous[e].bounds);
+        if (!claimed[e] && value >= bestOverlap) {
+          best = e;
+          bestOverlap = value;
+        }
+      }
+
+      // The contour must still look like the target, so something else
+      // moving into the same place doesn't keep the old identity.
+      double reuseMatch = 0;
+      if (best >= 0) {
+        const rv::Target& target = targets[previous[best].target];
+        rv::HuMoments targetMoments = target.cacheBuilt() ? target.huMoments : rv::HuMoments(cv::moments(target.shape));
+        reuseMatch = contour.huMoments().compare(targetMoments);
+        if (reuseMatch > maxMatch) {
+          best = -1;
+        }
+      }
+
+      if (best >= 0) {
+        const Entry& entry = previous[best];
+        cv::Point2f offset = (cv::Point2f(bounds.tl()) + cv::Point2f(bounds.br())) * 0.5f
+                           - (cv::Point2f(entry.bounds.tl()) + cv::Point2f(entry.bounds.br())) * 0.5f;
+        double maxDistance = maxSnap * std::max(bounds.width, bounds.height);
+
+        rv::IndexedTargetMatch match{i, entry.target, reuseMatch, {}};
+        if (snapPoints(entry.imagePoints, offset, contour.contour(), maxDistance, snappedIndices, match.imagePoints)) {
+          claimed[best] = true;
+          matches.push_back(std::move(match));
+          continue;
+        }
+      }
+
+      // Anything not reused is matched from scratch.
+      double value;
+      int target = index.nearest(contour.huMoments(), maxMatch, value);
+      if (target >= 0) {
+        fresh.push_back({i, target, value, {}});
+      }
+    }
+    reusedCount = matches.size();
+
+    // Only the new contours go through the full matching.
+    rv::matchTargetPoints(features, targets, fresh);
+    for (auto& match : fresh) {
+      matches.push_back(std::move(match));
+    }
+    std::sort(matches.begin(), matches.end(), [](const rv::IndexedTargetMatch& a, const rv::IndexedTargetMatch& b) {
+      return a.contour < b.contour;
+    });
+
+    // Remember this frame's matches for the next one.
+    previous.resize(matches.size());
+    for (int m = 0; m < matches.size(); m++) {
+      previous[m].bounds = features[matches[m].contour].boundingRect();
+      previous[m].target = matches[m].target;
+      previous[m].imagePoints = matches[m].imagePoints;
+    }
+  }
+}
@@ -0,0 +1,640 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <map>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "rambunctionVision/imageProcessing.hpp"
+#include "rambunctionVision/bitMask.hpp"
+#include "rambunctionVision/contourProcessing.hpp"
+#include "rambunctionVision/conversions.hpp"
+#include "rambunctionVision/contourArena.hpp"
+
+template<typename Function>
+double timeFunction(int iterations, Function function);
+
+void benchmarkTable(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int bits);
+void benchmarkParallel(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int method);
+void benchmarkBitMask(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations);
+void benchmarkNGon(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int sides);
+void benchmarkContours(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations);
+void benchmarkPose(std::vector<cv::Mat>& images, int iterations);
+void benchmarkCircles(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations);
+void benchmarkArena(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations);
+void benchmarkFused(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations);
+
+int main (int argc, char** argv) {
+
+  //****************************************************************************
+  // Argument Parsing
+  //****************************************************************************
+
+  // Keys for argument parsing (The flags you can set on the executable)
+  const std::string keys =
+  "{ h ? help usage |       | prints this message                   }"
+  "{ m mode         | table | Benchmark to run (table, parallel, bitmask, ngon, contours, pose, circles, arena, fused) }"
+  "{ i images       |       | Directory of images to benchmark with }"
+  "{ t thresholding |       | File holding image thresholding data  }"
+  "{ n iterations   | 100   | Times to run each method on an image  }"
+  "{ bits           | 6     | Bits per channel of the color table   }"
+  "{ method         | 0     | Threshold method (0 legacy, 1 fused, 2 table) }"
+  "{ sides          | 4     | Sides to approximate contours to      }";
+
+  // Object to parse any argument given
+  cv::CommandLineParser parser(argc, argv, keys);
+  parser.about("\nvision2021 v0.0.0 benchmark"
+               "\nTool to time diffrent methods against each other\n");
+
+  // Show help if help is flagged.
+  if (parser.has("help")) {
+    parser.printMessage();
+    return 0;
+  }
+
+  // Get arguments from the parser
+  std::string mode = parser.get<std::string>("mode");
+  std::string pathToImages = parser.get<std::string>("images");
+  std::string threshFile = parser.get<std::string>("thresholding");
+  int iterations = std::max(parser.get<int>("iterations"), 1);
+  int bits = parser.get<int>("bits");
+  int method = parser.get<int>("method");
+  int sides = parser.get<int>("sides");
+
+  // Cheack for errors
+  if (!parser.check()) {
+    parser.printErrors();
+    return 0;
+  }
+
+  //****************************************************************************
+  // Extract Data From Input Files
+  //****************************************************************************
+
+  // Variable to hold any thresholding data.
+  rv::Threshold threshold;
+
+  // If a file was given, extract the data from that file
+  if (threshFile != "") {
+    if (std::filesystem::exists(threshFile)) {
+      cv::FileStorage storage(threshFile, cv::FileStorage::READ);
+      if (storage.isOpened()) {
+        storage["Threshold"] >> threshold;
+      } else {
+        std::cerr << "Error opening input file: '" << threshFile << "'\n";
+        return 0;
+      }
+      storage.release();
+    } else {
+      std::cerr << "Could not find input file: '" << threshFile << "'\n";
+      return 0;
+    }
+  }
+
+  // Pull images from the folder into the vector of images
+  std::vector<cv::Mat> images;
+  if (!rv::extractImagesFromDirectory(pathToImages, images)) {
+    std::cerr << "File: '" << pathToImages << "' does not exist\n";
+    return 0;
+  }
+
+  if (images.empty()) {
+    std::cerr << "No images could be found at '" << pathToImages << "'\n";
+    return 0;
+  }
+
+  //****************************************************************************
+  // Run Benchmarks
+  //****************************************************************************
+
+  if (mode == "table") {
+    benchmarkTable(images, threshold, iterations, bits);
+  } else if (mode == "parallel") {
+    benchmarkParallel(images, threshold, iterations, method);
+  } else if (mode == "bitmask") {
+    benchmarkBitMask(images, threshold, iterations);
+  } else if (mode == "ngon") {
+    benchmarkNGon(images, threshold, iterations, sides);
+  } else if (mode == "contours") {
+    benchmarkContours(images, threshold, iterations);
+  } else if (mode == "pose") {
+    benchmarkPose(images, iterations);
+  } else if (mode == "circles") {
+    benchmarkCircles(images, threshold, iterations);
+  } else if (mode == "arena") {
+    benchmarkArena(images, threshold, iterations);
+  } else if (mode == "fused") {
+    benchmarkFused(images, threshold, iterations);
+  } else {
+    std::cerr << "Unknown benchmark: '" << mode << "'\n";
+  }
+
+  return 0;
+}
+
+template<typename Function>
+double timeFunction(int iterations, Function function) {
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    function();
+  }
+  std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+
+  // Average milliseconds per call
+  return time.count() / iterations;
+}
+
+void benchmarkTable(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int bits) {
+  rv::ColorTable table;
+  double buildTime = timeFunction(1, [&]() { table.build(threshold.low, threshold.high, bits); });
+  std::cout << "Built " << bits << " bit color table in " << buildTime << " ms\n\n";
+
+  for (int i = 0; i < images.size(); i++) {
+    // Both methods are timed after the blur, since that is the same for both.
+    cv::Mat blur, hsv, rangeMask, tableMask, difference;
+    cv::blur(images[i], blur, cv::Size(std::max(threshold.blurSize, 1), std::max(threshold.blurSize, 1)));
+
+    double rangeTime = timeFunction(iterations, [&]() {
+      cv::cvtColor(blur, hsv, cv::COLOR_BGR2HSV);
+
+      // A wrapping hue range needs a second pass.
+      if (threshold.wrapsHue()) {
+        cv::Mat upper;
+        cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(180, threshold.high[1], threshold.high[2]), rangeMask);
+        cv::inRange(hsv, cv::Scalar(0, threshold.low[1], threshold.low[2]), cv::Scalar(threshold.high), upper);
+        cv::bitwise_or(rangeMask, upper, rangeMask);
+      } else {
+        cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(threshold.high), rangeMask);
+      }
+    });
+
+    double tableTime = timeFunction(iterations, [&]() {
+      table.apply(blur, tableMask);
+    });
+
+    // How many pixels the table classifies diffrently.
+    cv::bitwise_xor(rangeMask, tableMask, difference);
+    double mismatch = 100.0 * cv::countNonZero(difference) / rangeMask.total();
+
+    std::cout << "Image " << i << " (" << blur.cols << "x" << blur.rows << ")\n"
+              << "  cvtColor + inRange: " << rangeTime << " ms\n"
+              << "  ColorTable:         " << tableTime << " ms\n"
+              << "  Speedup:            " << rangeTime / tableTime << "x\n"
+              << "  Mismatched pixels:  " << mismatch << "%\n";
+  }
+}
+
+void benchmarkParallel(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int method) {
+  const int threads = cv::getNumberOfCPUs();
+
+  // One context for every image and thread count, like a detector would
+  // keep, so its bands shrink into buffers left from larger ones.
+  rv::ParallelThresholdContext parallel(method);
+
+  for (int i = 0; i < images.size(); i++) {
+    std::cout << "Image " << i << " (" << images[i].cols << "x" << images[i].rows << ")\n";
+
+    // Everything is compared to the serial context running on one thread.
+    double baseTime = 0;
+    for (int n = 1; n <= threads; n++) {
+      cv::setNumThreads(n);
+
+      rv::ThresholdContext serial(images[i].size(), method);
+      cv::Mat serialMask, parallelMask, difference;
+
+      // Run each once first so buffers are allocated before timing.
+      serial.apply(images[i], serialMask, threshold);
+      parallel.apply(images[i], parallelMask, threshold);
+
+      double serialTime = timeFunction(iterations, [&]() { serial.apply(images[i], serialMask, threshold); });
+      double parallelTime = timeFunction(iterations, [&]() { parallel.apply(images[i], parallelMask, threshold); });
+      if (n == 1) {
+        baseTime = serialTime;
+      }
+
+      // The masks should be bit-identical.
+      cv::bitwise_xor(serialMask, parallelMask, difference);
+      int mismatch = cv::countNonZero(difference);
+
+      std::cout << "  " << n << " threads\n"
+                << "    ThresholdContext:         " << serialTime << " ms (" << baseTime / serialTime << "x)\n"
+                << "    ParallelThresholdContext: " << parallelTime << " ms (" << baseTime / parallelTime << "x)\n"
+                << "    Mismatched pixels:        " << mismatch << "\n";
+    }
+  }
+
+  // Back to OpenCV's default.
+  cv::setNumThreads(-1);
+}
+
+void benchmarkBitMask(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations) {
+  rv::BinaryMorphology openMorphology(threshold.openMatrix), closeMorphology(threshold.closeMatrix);
+  rv::BitMorphology openBits(threshold.openMatrix), closeBits(threshold.closeMatrix);
+
+  for (int i = 0; i < images.size(); i++) {
+    // Every method starts from the same mask before any morphology.
+    cv::Mat raw, cvMask, binaryMask, bitsMask, difference;
+    rv::fusedThreshold(images[i], raw, threshold);
+
+    double cvTime = timeFunction(iterations, [&]() {
+      cv::morphologyEx(raw, cvMask, cv::MORPH_OPEN, threshold.openMatrix);
+      cv::morphologyEx(cvMask, cvMask, cv::MORPH_CLOSE, threshold.closeMatrix);
+    });
+
+    double binaryTime = timeFunction(iterations, [&]() {
+      openMorphology.apply(cv::MORPH_OPEN, raw, binaryMask);
+      closeMorphology.apply(cv::MORPH_CLOSE, binaryMask, binaryMask);
+    });
+
+    // Packing and unpacking are timed seperately, since a pipeline
+    // using BitMask would only need to unpack for cv::findContours.
+    rv::BitMask bits;
+    double packTime = timeFunction(iterations, [&]() { bits.fromMat(raw); });
+    double bitsTime = timeFunction(iterations, [&]() {
+      bits.fromMat(raw);
+      openBits.apply(cv::MORPH_OPEN, bits, bits);
+      closeBits.apply(cv::MORPH_CLOSE, bits, bits);
+    }) - packTime;
+    double unpackTime = timeFunction(iterations, [&]() { bits.toMat(bitsMask); });
+
+    cv::bitwise_xor(cvMask, bitsMask, difference);
+    int mismatch = cv::countNonZero(difference);
+    cv::bitwise_xor(cvMask, binaryMask, difference);
+    mismatch += cv::countNonZero(difference);
+
+    std::cout << "Image " << i << " (" << raw.cols << "x" << raw.rows << ")\n"
+              << "  cv::morphologyEx:  " << cvTime << " ms\n"
+              << "  BinaryMorphology:  " << binaryTime << " ms\n"
+              << "  BitMorphology:     " << bitsTime << " ms (" << packTime << " ms to pack, " << unpackTime << " ms to unpack)\n"
+              << "  Area:              " << bits.area() << " pixels\n"
+              << "  Mismatched pixels: " << mismatch << "\n";
+  }
+}
+
+void benchmarkNGon(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations, int sides) {
+  // The linear search approximateNGon used to do, with the
+  // range used by matchTargetPoints.
+  const double start = 15, end = 50, step = 0.5;
+  auto linearNGon = [&](const std::vector<cv::Point2f>& src, std::vector<cv::Point2f>& dst, int& calls) {
+    std::vector<cv::Point2f> aprox;
+    for (double epsilon = start; epsilon < end; epsilon += step) {
+      cv::approxPolyDP(src, aprox, epsilon, true);
+      calls++;
+      if (aprox.size() <= sides) {
+        dst = aprox;
+        return aprox.size() == sides;
+      }
+    }
+    return false;
+  };
+
+  for (int i = 0; i < images.size(); i++) {
+    cv::Mat mask;
+    rv::thresholdImage(images[i], mask, threshold);
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    std::vector<std::vector<cv::Point2f>> shapes;
+    for (auto& contour : contours) {
+      if (cv::contourArea(contour) >= 50) {
+        shapes.push_back(rv::convertToPoints<float>(contour));
+      }
+    }
+
+    // Count how many contours each method could approximate, and how many
+    // times cv::approxPolyDP was called by the linear search.
+    int linearFound = 0, hierarchyFound = 0, calls = 0, disagree = 0;
+    for (auto& shape : shapes) {
+      std::vector<cv::Point2f> linear, hierarchy;
+      bool linearResult = linearNGon(shape, linear, calls);
+      bool hierarchyResult = rv::approximateNGon(shape, hierarchy, sides, start, end, step);
+      linearFound += linearResult;
+      hierarchyFound += hierarchyResult;
+      // They disagree if only one found an approximation, or they kept diffrent points.
+      disagree += linearResult != hierarchyResult || (linearResult && linear != hierarchy);
+    }
+
+    double linearTime = timeFunction(iterations, [&]() {
+      std::vector<cv::Point2f> dst;
+      int unused = 0;
+      for (auto& shape : shapes) {
+        linearNGon(shape, dst, unused);
+      }
+    });
+
+    double hierarchyTime = timeFunction(iterations, [&]() {
+      std::vector<cv::Point2f> dst;
+      for (auto& shape : shapes) {
+        rv::approximateNGon(shape, dst, sides, start, end, step);
+      }
+    });
+
+    std::cout << "Image " << i << " (" << shapes.size() << " contours)\n"
+              << "  Linear search:     " << linearTime << " ms (" << linearFound << " found, " << calls << " approxPolyDP calls)\n"
+              << "  approximateNGon:   " << hierarchyTime << " ms (" << hierarchyFound << " found)\n"
+              << "  Speedup:           " << linearTime / hierarchyTime << "x\n"
+              << "  Disagreements:     " << disagree << "\n";
+  }
+}
+
+void benchmarkContours(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations) {
+  const int defaultThreshold = rv::getParallelThreshold();
+
+  // Poses are found with a made up camera, since only the time matters.
+  rv::Ball ball;
+  ball.radius = 3.5;
+  ball.center = cv::Point3f(0, 0, 0);
+
+  for (int i = 0; i < images.size(); i++) {
+    cv::Mat mask;
+    rv::thresholdImage(images[i], mask, threshold);
+
+    std::vector<std::vector<cv::Point>> found;
+    cv::findContours(mask, found, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    if (found.empty()) {
+      std::cout << "Image " << i << " has no contours\n";
+      continue;
+    }
+
+    double focal = images[i].cols;
+    cv::Mat cameraMatrix(cv::Matx33d(focal, 0, images[i].cols / 2.0, 0, focal, images[i].rows / 2.0, 0, 0, 1));
+    cv::Mat distortion = cv::Mat::zeros(1, 5, CV_64F);
+
+    std::cout << "Image " << i << " (" << found.size() << " contours)\n";
+
+    // Repeat the image's contours to see how each stage scales.
+    for (int count = 1; count <= 256; count *= 4) {
+      std::vector<std::vector<cv::Point>> contours;
+      for (int c = 0; c < count; c++) {
+        contours.push_back(found[c % found.size()]);
+      }
+
+      std::vector<rv::IndexedCircleMatch> serialCircles, parallelCircles;
+      std::vector<rv::IndexedBallPose> serialPoses, parallelPoses;
+
+      rv::setParallelThreshold(INT_MAX);
+      double serialTime = timeFunction(iterations, [&]() {
+        rv::findCircles(contours, 0, 0, serialCircles);
+        rv::estimateBallPose(serialCircles, ball, cameraMatrix, distortion, serialPoses);
+      });
+
+      rv::setParallelThreshold(1);
+      double parallelTime = timeFunction(iterations, [&]() {
+        rv::findCircles(contours, 0, 0, parallelCircles);
+        rv::estimateBallPose(parallelCircles, ball, cameraMatrix, distortion, parallelPoses);
+      });
+
+      // Both should find the same circles in the same order.
+      int mismatch = std::abs(static_cast<int>(serialCircles.size()) - static_cast<int>(parallelCircles.size()));
+      for (int c = 0; c < std::min(serialCircles.size(), parallelCircles.size()); c++) {
+        mismatch += serialCircles[c].contour != parallelCircles[c].contour;
+      }
+
+      std::cout << "  " << count << " contours\n"
+                << "    Serial:     " << serialTime << " ms\n"
+                << "    Parallel:   " << parallelTime << " ms (" << serialTime / parallelTime << "x)\n"
+                << "    Mismatches: " << mismatch << "\n";
+    }
+  }
+
+  rv::setParallelThreshold(defaultThreshold);
+}
+
+void benchmarkPose(std::vector<cv::Mat>& images, int iterations) {
+  // The outline of the power port, in inches.
+  rv::Target target;
+  target.name = "powerPort";
+  target.shape = {{-19.625f, 0}, {-9.8125f, 17}, {9.8125f, 17}, {19.625f, 0}};
+  target.updateCache();
+  std::vector<rv::Target> targets = {target};
+
+  cv::RNG rng(2021);
+
+  for (int i = 0; i < images.size(); i++) {
+    // Only the size of the image is used, for a made up camera.
+    double focal = images[i].cols;
+    cv::Mat cameraMatrix(cv::Matx33d(focal, 0, images[i].cols / 2.0, 0, focal, images[i].rows / 2.0, 0, 0, 1));
+    cv::Mat distortion(cv::Matx<double, 1, 5>(0.05, -0.02, 0, 0, 0));
+
+    std::cout << "Image " << i << " (" << images[i].cols << "x" << images[i].rows << ")\n";
+
+    for (int count = 1; count <= 64; count *= 4) {
+      // Project the target from random poses in front of the camera,
+      // with a little noise on the points.
+      std::vector<rv::IndexedTargetMatch> matches(count);
+      std::vector<cv::Vec3d> trueTvecs(count);
+      for (int m = 0; m < count; m++) {
+        cv::Vec3d rvec(rng.uniform(-0.3, 0.3), rng.uniform(-0.8, 0.8), rng.uniform(-0.2, 0.2));
+        trueTvecs[m] = cv::Vec3d(rng.uniform(-40.0, 40.0), rng.uniform(-20.0, 20.0), rng.uniform(150.0, 400.0));
+
+        std::vector<cv::Point2f> projected;
+        cv::projectPoints(target.objectPoints, rvec, trueTvecs[m], cameraMatrix, distortion, projected);
+        for (auto& point : projected) {
+          point += cv::Point2f(rng.gaussian(0.5), rng.gaussian(0.5));
+        }
+        matches[m] = {m, 0, 0, projected};
+      }
+
+      // The old path, building the object points for every match
+      // and solving iteratively on distorted points.
+      std::vector<cv::Mat> oldRvecs(count), oldTvecs(count);
+      double oldTime = timeFunction(iterations, [&]() {
+        for (int m = 0; m < count; m++) {
+          cv::solvePnP(rv::convertToPoints3<float>(targets[0].shape), matches[m].imagePoints, cameraMatrix, distortion, oldRvecs[m], oldTvecs[m]);
+        }
+      });
+
+      std::vector<rv::IndexedTargetPose> poses, warmPoses;
+      double planarTime = timeFunction(iterations, [&]() {
+        rv::estimateTargetPose(targets, matches, cameraMatrix, distortion, poses);
+      });
+
+      // Every match is where it was last frame, so every pose is refined.
+      double warmTime = timeFunction(iterations, [&]() {
+        rv::estimateTargetPose(targets, matches, cameraMatrix, distortion, poses, 2.0, warmPoses);
+      });
+
+      // How far each pose puts the target from where it really is.
+      double oldDistance = 0, planarDistance = 0, planarError = 0;
+      for (int m = 0; m < count; m++) {
+        oldDistance += cv::norm(cv::Vec3d(oldTvecs[m]) - trueTvecs[m]) / count;
+        planarDistance += cv::norm(cv::Vec3d(poses[m].tvec) - trueTvecs[m]) / count;
+        planarError += poses[m].error / count;
+      }
+
+      std::cout << "  " << count << " targets\n"
+                << "    Iterative: " << oldTime << " ms (" << oldDistance << " in off)\n"
+                << "    Planar:    " << planarTime << " ms (" << planarDistance << " in off, " << planarError << " px error, " << oldTime / planarTime << "x)\n"
+                << "    Refined:   " << warmTime << " ms (" << oldTime / warmTime << "x)\n";
+    }
+  }
+}
+
+void benchmarkCircles(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations) {
+  // Serial, so the time is just the fitting.
+  const int defaultThreshold = rv::getParallelThreshold();
+  rv::setParallelThreshold(INT_MAX);
+
+  for (int i = 0; i < images.size(); i++) {
+    cv::Mat mask;
+    rv::thresholdImage(images[i], mask, threshold);
+
+    // Found the same way as ball detection.
+    rv::ContourArena contours(cv::CHAIN_APPROX_SIMPLE);
+    contours.find(mask);
+
+    std::vector<rv::IndexedCircleMatch> enclosing, algebraic;
+    double enclosingTime = timeFunction(iterations, [&]() {
+      rv::findCircles(contours, 50, 0.60, enclosing, rv::CIRCLE_ENCLOSING);
+    });
+    double algebraicTime = timeFunction(iterations, [&]() {
+      rv::findCircles(contours, 50, 0.60, algebraic, rv::CIRCLE_ALGEBRAIC);
+    });
+
+    // Compare the circles of contours both methods accepted.
+    int both = 0;
+    double centerOffset = 0, radiusOffset = 0;
+    for (int a = 0, b = 0; a < enclosing.size() && b < algebraic.size();) {
+      if (enclosing[a].contour < algebraic[b].contour) {
+        a++;
+      } else if (algebraic[b].contour < enclosing[a].contour) {
+        b++;
+      } else {
+        cv::Point2f offset = enclosing[a].circle.center - algebraic[b].circle.center;
+        centerOffset += std::sqrt(offset.dot(offset));
+        radiusOffset += std::abs(enclosing[a].circle.radius - algebraic[b].circle.radius);
+        both++;
+        a++;
+        b++;
+      }
+    }
+
+    std::cout << "Image " << i << " (" << contours.size() << " contours)\n"
+              << "  Enclosing: " << enclosingTime << " ms (" << enclosing.size() << " circles)\n"
+              << "  Algebraic: " << algebraicTime << " ms (" << algebraic.size() << " circles, " << enclosingTime / algebraicTime << "x)\n"
+              << "  Both:      " << both << " circles";
+    if (both > 0) {
+      std::cout << ", centers " << centerOffset / both << " px apart, radii " << radiusOffset / both << " px apart";
+    }
+    std::cout << "\n";
+  }
+
+  rv::setParallelThreshold(defaultThreshold);
+}
+
+void benchmarkArena(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations) {
+  // Counts the contours that differ between the arena and cv::findContours.
+  // Outer contours never share pixels, so each is paired up by its first
+  // point, and paired contours must have exactly the same points.
+  auto compare = [](const rv::ContourArena& arena, const std::vector<std::vector<cv::Point>>& expected, int& missing, int& extra, int& different) {
+    std::map<std::pair<int, int>, int> byStart;
+    for (int c = 0; c < expected.size(); c++) {
+      byStart[{expected[c][0].y, expected[c][0].x}] = c;
+    }
+
+    for (int c = 0; c < arena.size(); c++) {
+      auto found = byStart.find({arena.begin(c)->y, arena.begin(c)->x});
+      if (found == byStart.end()) {
+        extra++;
+        continue;
+      }
+      const std::vector<cv::Point>& points = expected[found->second];
+      if (arena.length(c) != points.size() || !std::equal(points.begin(), points.end(), arena.begin(c))) {
+        different++;
+      }
+      byStart.erase(found);
+    }
+    missing += byStart.size();
+  };
+
+  for (int i = 0; i < images.size(); i++) {
+    cv::Mat mask;
+    rv::thresholdImage(images[i], mask, threshold);
+
+    // The four quarters of the frame, found one after the other into the
+    // same arena like RegionSearch does, so the labels are reused at
+    // diffrent sizes and the contours are offset.
+    const int halfWidth = mask.cols / 2, halfHeight = mask.rows / 2;
+    const cv::Rect quarters[4] = {
+      {0, 0, halfWidth, halfHeight},
+      {halfWidth, 0, mask.cols - halfWidth, halfHeight},
+      {0, halfHeight, halfWidth, mask.rows - halfHeight},
+      {halfWidth, halfHeight, mask.cols - halfWidth, mask.rows - halfHeight}
+    };
+
+    std::cout << "Image " << i << "\n";
+    for (int method : {cv::CHAIN_APPROX_NONE, cv::CHAIN_APPROX_SIMPLE}) {
+      std::vector<std::vector<cv::Point>> expected, regionExpected, regionContours;
+      rv::ContourArena arena(method), regionArena(method);
+
+      double opencvTime = timeFunction(iterations, [&]() {
+        cv::findContours(mask, expected, cv::RETR_EXTERNAL, method);
+      });
+      double arenaTime = timeFunction(iterations, [&]() {
+        arena.find(mask);
+      });
+
+      regionArena.clear();
+      for (auto& quarter : quarters) {
+        cv::findContours(mask(quarter), regionContours, cv::RETR_EXTERNAL, method, quarter.tl());
+        regionExpected.insert(regionExpected.end(), regionContours.begin(), regionContours.end());
+        regionArena.add(mask(quarter), quarter.tl());
+      }
+
+      int missing = 0, extra = 0, different = 0;
+      compare(arena, expected, missing, extra, different);
+      compare(regionArena, regionExpected, missing, extra, different);
+
+      std::cout << "  " << (method == cv::CHAIN_APPROX_NONE ? "CHAIN_APPROX_NONE" : "CHAIN_APPROX_SIMPLE")
+                << " (" << expected.size() << " contours)\n"
+                << "    cv::findContours: " << opencvTime << " ms\n"
+                << "    ContourArena:     " << arenaTime << " ms (" << opencvTime / arenaTime << "x)\n"
+                << "    Missing: " << missing << ", extra: " << extra << ", different: " << different << "\n";
+    }
+  }
+}
+
+void benchmarkFused(std::vector<cv::Mat>& images, rv::Threshold& threshold, int iterations) {
+  rv::ThresholdContext legacy(rv::THRESHOLD_LEGACY), fused(rv::THRESHOLD_FUSED);
+
+  for (int i = 0; i < images.size(); i++) {
+    // Before any morphology, which is where the two can actually differ.
+    cv::Mat blur, hsv, legacyRange, fusedRange, upper, difference;
+    const cv::Size blurSize(std::max(threshold.blurSize, 1), std::max(threshold.blurSize, 1));
+    cv::blur(images[i], blur, blurSize);
+    cv::cvtColor(blur, hsv, cv::COLOR_BGR2HSV);
+    if (threshold.wrapsHue()) {
+      cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(180, threshold.high[1], threshold.high[2]), legacyRange);
+      cv::inRange(hsv, cv::Scalar(0, threshold.low[1], threshold.low[2]), cv::Scalar(threshold.high), upper);
+      cv::bitwise_or(legacyRange, upper, legacyRange);
+    } else {
+      cv::inRange(hsv, cv::Scalar(threshold.low), cv::Scalar(threshold.high), legacyRange);
+    }
+    rv::fusedThreshold(images[i], fusedRange, threshold);
+
+    cv::bitwise_xor(legacyRange, fusedRange, difference);
+    int rangeMismatch = cv::countNonZero(difference);
+
+    // The whole chain, including the morphology.
+    cv::Mat legacyMask, fusedMask;
+    double legacyTime = timeFunction(iterations, [&]() { legacy.apply(images[i], legacyMask, threshold); });
+    double fusedTime = timeFunction(iterations, [&]() { fused.apply(images[i], fusedMask, threshold); });
+
+    cv::bitwise_xor(legacyMask, fusedMask, difference);
+    int maskMismatch = cv::countNonZero(difference);
+    const double total = legacyMask.total();
+
+    std::cout << "Image " << i << " (" << images[i].cols << "x" << images[i].rows << ")\n"
+              << "  THRESHOLD_LEGACY:             " << legacyTime << " ms\n"
+              << "  THRESHOLD_FUSED:              " << fusedTime << " ms (" << legacyTime / fusedTime << "x)\n"
+              << "  Mismatched before morphology: " << rangeMismatch << " pixels (" << 100.0 * rangeMismatch / total << "%)\n"
+              << "  Mismatched masks:             " << maskMismatch << " pixels (" << 100.0 * maskMismatch / total << "%)\n";
+  }
+}
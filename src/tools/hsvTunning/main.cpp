@@ -31,7 +31,8 @@ int main(int argc, char** argv) {
   "{ out output     |   | Output file                           }"
   "{ camera         |   | Output file                           }"
   "{ target         |   | Output file                           }"
-  "{ ball           |   | Output file                           }";
+  "{ ball           |   | Output file                           }"
+  "{ method         | 0 | Threshold method (0 legacy, 1 fused, 2 table) }";
 
   // Object to parse any argument given
   cv::CommandLineParser parser(argc, argv, keys);
@@ -54,6 +55,7 @@ int main(int argc, char** argv) {
   std::string cameraFile = parser.get<std::string>("camera");
   std::string targetsFile = parser.get<std::string>("target");
   std::string ballFile = parser.get<std::string>("ball");
+  int threshMethod = parser.get<int>("method");
 
   // Cheack for errors
   if (!parser.check()) {
@@ -227,6 +229,9 @@ int main(int argc, char** argv) {
   bool ballDetection = false, targetDetection = false;
   bool estimatePose = false;
 
+  // Reusable thresholding buffers
+  rv::ThresholdContext thresholdContext(threshMethod);
+
   cv::Mat image, thresh, display;
   while (true) {
     // -----------
@@ -258,8 +263,11 @@ int main(int argc, char** argv) {
       threshold.openMatrix = cv::getStructuringElement(openShape, {std::max(openSize, 1), std::max(openSize, 1)});
     }
 
+    // Rebuild the color lookup table only if the hsv sliders moved.
+    threshold.updateTable();
+
     // Threshold thge image acording to the sliders into the `thresh` variable.
-    rv::thresholdImage(image, thresh, threshold);
+    thresholdContext.apply(image, thresh, threshold);
 
     // --------------------
     // Prepare for display
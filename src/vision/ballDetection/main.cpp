@@ -2,7 +2,7 @@
 #include <string>
 #include <vector>
 #include <filesystem>
-#include <ctime>
+#include <chrono>
 
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
@@ -16,6 +16,9 @@
 #include <rambunctionVision/camera.hpp>
 #include <rambunctionVision/imageProcessing.hpp>
 #include <rambunctionVision/contourProcessing.hpp>
+#include <rambunctionVision/blobProcessing.hpp>
+#include <rambunctionVision/regionProcessing.hpp>
+#include <rambunctionVision/tracking.hpp>
 
 int main (int argc, char** argv) {
   
@@ -29,7 +32,13 @@ int main (int argc, char** argv) {
   "{ id cameraID    | 0 | Camera id used for thresholding       }"
   "{ c camera       |   | File holding camera calibration       }"
   "{ t thresholding |   | File holding image thresholding data  }"
-  "{ b ball         |   | File with ball size data              }";
+  "{ b ball         |   | File with ball size data              }"
+  "{ method         | 0 | Threshold method (0 legacy, 1 fused, 2 table) }"
+  "{ roi            | 0 | Frames between full frame searches (0 disables regions of interest) }"
+  "{ padding        | 32 | Pixels to pad each region of interest }"
+  "{ pyramid        | 0 | Times to halve the frame for full frame searches (0, 1 or 2) }"
+  "{ blobs          |   | Find balls from connected blobs instead of contours }"
+  "{ extrapolate    |   | Move each ball along its velocity to when it's sent }";
 
   // Object to parse any argument given
   cv::CommandLineParser parser(argc, argv, keys);
@@ -46,6 +55,12 @@ int main (int argc, char** argv) {
   int cameraID = parser.get<double>("cameraID");
   std::string cameraFile = parser.get<std::string>("camera");
   std::string threshFile = parser.get<std::string>("thresholding");
+  int threshMethod = parser.get<int>("method");
+  int rescanInterval = parser.get<int>("roi");
+  int padding = parser.get<int>("padding");
+  int pyramidLevels = parser.get<int>("pyramid");
+  bool useBlobs = parser.has("blobs");
+  bool extrapolate = parser.has("extrapolate");
   std::string ballFile = parser.get<std::string>("ball");
 
   // Cheack for errors
@@ -54,6 +69,11 @@ int main (int argc, char** argv) {
     return 0;
   }
 
+  if (pyramidLevels < 0 || pyramidLevels > 2) {
+    std::cerr << "Pyramid levels must be 0, 1 or 2, not " << pyramidLevels << "\n";
+    return 0;
+  }
+
   //****************************************************************************
   // Extract Data From Input Files
   //****************************************************************************
@@ -105,6 +125,9 @@ int main (int argc, char** argv) {
     }
   }
 
+  // Build the color lookup table in case it's used.
+  threshold.updateTable();
+
   rv::Ball ball;
 
   if (ballFile != "") {
@@ -141,6 +164,11 @@ int main (int argc, char** argv) {
     return 0;
   }
 
+  // Buffers for thresholding, sized to the camera so no frame reallocates them.
+  // Only regions around the last frame's detections are searched when enabled.
+  cv::Size frameSize(static_cast<int>(capture.get(cv::CAP_PROP_FRAME_WIDTH)), static_cast<int>(capture.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  rv::RegionSearch regionSearch(frameSize, threshMethod, rescanInterval, padding, pyramidLevels);
+
   //****************************************************************************
   // Network Tables Setup
   //****************************************************************************
@@ -153,16 +181,22 @@ int main (int argc, char** argv) {
   // | | | numBalls
   // | | | ballSize
   // | | | sortMethod
+  // | | | timestamp
   // | | | Ball0
+  // | | | | id
   // | | | | tvec
   // | | | | x
   // | | | | y
   // | | | | z
+  // | | | | velocity
+  // | | | | predicted
   // | | | | rvec
   // | | | | roll
   // | | | | pitch
   // | | | | yaw
   // | | | | match
+  // | | | | missed
+  // | | | | timestamp
   // | | | | age
   // | | | Ball1
   // | | | Ball2
@@ -206,6 +240,7 @@ int main (int argc, char** argv) {
 
   // Initilize Ball Data
   ballTable->GetEntry("numBalls").SetDouble(0);
+  ballTable->GetEntry("timestamp").SetDouble(0);
   ballTable->GetEntry("ballRadius").SetDouble(ball.radius);
   ballTable->GetEntry("sortMethod").SetString("Closest");
 
@@ -219,16 +254,37 @@ int main (int argc, char** argv) {
   timeTable->GetEntry("totalTime").SetDouble(0);
 
   cv::Mat frame, thresh;
+
+  // Kept between frames so thier memory is reused.
+  rv::ContourArena contours(cv::CHAIN_APPROX_SIMPLE);
+  std::vector<rv::ContourFeatures> features;
+  std::vector<rv::Blob> blobs;
+  std::vector<rv::IndexedCircleMatch> circles;
+  std::vector<rv::IndexedBallPose> positions;
+  std::vector<cv::Point3d> detections;
+
+  // Follows the balls between frames so each keeps the same id.
+  rv::Tracker tracker;
+  double lastTimestamp = -1;
+
   while (true) {
     // Start of processing time to calculate frame rate.
     auto start = std::chrono::high_resolution_clock::now();
 
     // Get the next frame
     auto captureStart = std::chrono::high_resolution_clock::now();
-    capture >> frame;
+    // The frame is stamped between grabbing and decoding it, so
+    // the time it takes to decode isn't counted in its age.
+    // A failed grab or retrieve leaves the last frame in place, so
+    // both are checked as well as the frame itself.
+    if (!capture.grab()) {
+      std::cerr << "Lost connection to camera\n";
+      break;
+    }
+    double timestamp = rv::captureTimestamp(capture);
 
     // Check camera data.
-    if (frame.empty()) {
+    if (!capture.retrieve(frame) || frame.empty()) {
       std::cerr << "Lost connection to camera\n";
       break;
     }
@@ -237,53 +293,88 @@ int main (int argc, char** argv) {
 
     // Threshold image.
     auto threshStart = std::chrono::high_resolution_clock::now();
-    rv::thresholdImage(frame, thresh, threshold);
+    regionSearch.threshold(frame, thresh, threshold);
     std::chrono::duration<double> threshTime = std::chrono::duration_cast<std::chrono::microseconds>(threshStart - std::chrono::high_resolution_clock::now());
 
-    // Find contours in the image for ball detection.
+    // Find contours (or blobs) in the image for ball detection.
     auto contourStart = std::chrono::high_resolution_clock::now();
-    std::vector<std::vector<cv::Point>> contours;
-    cv::findContours(thresh, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+    if (useBlobs) {
+      regionSearch.findBlobs(thresh, blobs);
+    } else {
+      regionSearch.findContours(thresh, contours);
+      rv::findFeatures(contours, features);
+    }
     std::chrono::duration<double> contourTime = std::chrono::duration_cast<std::chrono::microseconds>(contourStart - std::chrono::high_resolution_clock::now());
 
     // Find all the contours that are sufficently circular to be balls.
     auto matchStart = std::chrono::high_resolution_clock::now();
-    std::vector<rv::CircleMatch> circles = rv::findCircles(contours, 50, 0.60);
+    if (useBlobs) {
+      rv::findCircles(blobs, 50, 0.60, circles);
+    } else {
+      rv::findCircles(features, 50, 0.60, circles);
+    }
     std::chrono::duration<double> matchTime = std::chrono::duration_cast<std::chrono::microseconds>(matchStart - std::chrono::high_resolution_clock::now());
 
     // Estimate the ball's poition from the circles.
     auto poseStart = std::chrono::high_resolution_clock::now();
-    std::vector<rv::BallPose> positions = rv::estimateBallPose(circles, ball, camera.matrix, camera.distortion);
+    rv::estimateBallPose(circles, ball, camera.matrix, camera.distortion, positions);
+
+    // Match the balls up with the ones from earlier frames.
+    detections.resize(positions.size());
+    for (int i = 0; i < positions.size(); i++) {
+      detections[i] = cv::Point3d(positions[i].tvec.at<double>(0), positions[i].tvec.at<double>(1), positions[i].tvec.at<double>(2));
+    }
+    // The time between captures, not between loops, is how far the balls moved.
+    double dt = lastTimestamp >= 0 ? timestamp - lastTimestamp : 0;
+    lastTimestamp = timestamp;
+    tracker.update(detections, rv::boundingRects(circles), dt);
+
+    // Search around the tracked balls in the next frame, including
+    // ones that were missed this frame.
+    regionSearch.update(tracker.regions());
     std::chrono::duration<double> poseTime = std::chrono::duration_cast<std::chrono::microseconds>(poseStart - std::chrono::high_resolution_clock::now());
 
     // Send data over the network
     auto networkStart = std::chrono::high_resolution_clock::now();
-    ballTable->GetEntry("numBalls").SetDouble(positions.size());
-    
-    // TODO: Add actual data
-    for (int i = 0; i < positions.size(); i++) {
-      auto table = tableInstance.GetTable("BallDetection/BallData/Ball" + std::to_string(i));
-      
-      // Position data
-      table->GetEntry("tvec").SetDoubleArray({positions[i].tvec.at<double>(0,0), positions[i].tvec.at<double>(0,1), positions[i].tvec.at<double>(0,2)});
-      table->GetEntry("x").SetDouble(positions[i].tvec.at<double>(0,0));
-      table->GetEntry("y").SetDouble(positions[i].tvec.at<double>(0,1));
-      table->GetEntry("z").SetDouble(positions[i].tvec.at<double>(0,2));
-
-      // Extract rotation from rvec
-      cv::Vec3d rotation = cv::RQDecomp3x3(positions[i].rvec, cv::noArray(), cv::noArray());
-
-      // Rotation data
-      table->GetEntry("rvec").SetDoubleArray({positions[i].rvec.at<double>(0,0), positions[i].rvec.at<double>(0,1), positions[i].rvec.at<double>(0,2)});
-      table->GetEntry("roll").SetDouble(rotation[0]);
-      table->GetEntry("pitch").SetDouble(rotation[1]);
-      table->GetEntry("yaw").SetDouble(rotation[2]);
+    // Only confirmed balls are sent, each with the id it keeps while tracked.
+    // When extrapolating, each ball is moved to where it should be now, to
+    // make up for the time the frame spent being processed.
+    double now = rv::steadyTime();
+    double age = now - timestamp;
+    int numBalls = 0;
+    for (auto& track : tracker.tracks()) {
+      if (!track.confirmed) {
+        continue;
+      }
+      auto table = tableInstance.GetTable("BallDetection/BallData/Ball" + std::to_string(numBalls++));
+      table->GetEntry("id").SetDouble(track.id);
+
+      // Position data, smoothed by the tracker.
+      cv::Point3d position = extrapolate ? track.at(age) : track.position;
+      table->GetEntry("tvec").SetDoubleArray({position.x, position.y, position.z});
+      table->GetEntry("x").SetDouble(position.x);
+      table->GetEntry("y").SetDouble(position.y);
+      table->GetEntry("z").SetDouble(position.z);
+      table->GetEntry("velocity").SetDoubleArray({track.velocity.x, track.velocity.y, track.velocity.z});
+      table->GetEntry("predicted").SetDoubleArray({track.predicted.x, track.predicted.y, track.predicted.z});
+
+      // Rotation data, a ball looks the same from every side.
+      table->GetEntry("rvec").SetDoubleArray({0, 0, 0});
+      table->GetEntry("roll").SetDouble(0);
+      table->GetEntry("pitch").SetDouble(0);
+      table->GetEntry("yaw").SetDouble(0);
 
       // Other info
-      table->GetEntry("match").SetDouble(positions[i].circleMatch.match);
-      std::time_t t = time(NULL);
-      table->GetEntry("age").SetString(std::asctime(std::gmtime(&t)));
+      table->GetEntry("match").SetDouble(track.detection >= 0 ? circles[positions[track.detection].circle].match : 0);
+      table->GetEntry("missed").SetDouble(track.misses);
+
+      // Time data, in seconds on the steady clock. The timestamp is when the
+      // position is for, and the age is how long ago the frame was captured.
+      table->GetEntry("timestamp").SetDouble(extrapolate ? now : timestamp);
+      table->GetEntry("age").SetDouble(age);
     }
+    ballTable->GetEntry("numBalls").SetDouble(numBalls);
+    ballTable->GetEntry("timestamp").SetDouble(timestamp);
 
     // Send time data
     timeTable->GetEntry("captureTime").SetDouble((captureTime.count() / 1000000));
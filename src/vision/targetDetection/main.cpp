@@ -2,7 +2,7 @@
 #include <string>
 #include <vector>
 #include <filesystem>
-#include <ctime>
+#include <chrono>
 
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
@@ -16,6 +16,9 @@
 #include <rambunctionVision/camera.hpp>
 #include <rambunctionVision/imageProcessing.hpp>
 #include <rambunctionVision/contourProcessing.hpp>
+#include <rambunctionVision/regionProcessing.hpp>
+#include <rambunctionVision/targetIndex.hpp>
+#include <rambunctionVision/tracking.hpp>
 
 int main (int argc, char** argv) {
   
@@ -29,7 +32,12 @@ int main (int argc, char** argv) {
   "{ id cameraID    | 0 | Camera id used for thresholding       }"
   "{ camera         |   | File holding camera calibration       }"
   "{ thresholding   |   | File holding image thresholding data  }"
-  "{ targets        |   | File with target data                 }";
+  "{ targets        |   | File with target data                 }"
+  "{ method         | 0 | Threshold method (0 legacy, 1 fused, 2 table) }"
+  "{ roi            | 0 | Frames between full frame searches (0 disables regions of interest) }"
+  "{ padding        | 32 | Pixels to pad each region of interest }"
+  "{ pyramid        | 0 | Times to halve the frame for full frame searches (0, 1 or 2) }"
+  "{ extrapolate    |   | Move each target along its tracked velocity to when it's sent }";
 
   // Object to parse any argument given
   cv::CommandLineParser parser(argc, argv, keys);
@@ -46,7 +54,12 @@ int main (int argc, char** argv) {
   int cameraID = parser.get<double>("cameraID");
   std::string cameraFile = parser.get<std::string>("camera");
   std::string threshFile = parser.get<std::string>("thresholding");
+  int threshMethod = parser.get<int>("method");
+  int rescanInterval = parser.get<int>("roi");
+  int padding = parser.get<int>("padding");
+  int pyramidLevels = parser.get<int>("pyramid");
   std::string targetsFile = parser.get<std::string>("targets");
+  bool extrapolate = parser.has("extrapolate");
 
   // Cheack for errors
   if (!parser.check()) {
@@ -54,6 +67,11 @@ int main (int argc, char** argv) {
     return 0;
   }
 
+  if (pyramidLevels < 0 || pyramidLevels > 2) {
+    std::cerr << "Pyramid levels must be 0, 1 or 2, not " << pyramidLevels << "\n";
+    return 0;
+  }
+
   //****************************************************************************
   // Extract Data From Input Files
   //****************************************************************************
@@ -105,28 +123,34 @@ int main (int argc, char** argv) {
     }
   }
 
+  // Build the color lookup table in case it's used.
+  threshold.updateTable();
+
   std::vector<rv::Target> targets;
 
   if (targetsFile != "") {
     if (std::filesystem::exists(targetsFile)) {
       cv::FileStorage storage(targetsFile, cv::FileStorage::READ);
       if (storage.isOpened()) {
-        storage["Targets"] >> targetsFile;
-        if (targets[0].shape.empty()) {
+        storage["Targets"] >> targets;
+        if (targets.empty() || targets[0].shape.empty()) {
           std::cerr << "Error extracting data from target file: '" << targetsFile << "'\n";
           return 0;  
         }
       } else {
-        std::cerr << "Error opening ball file: '" << targetsFile << "'\n";
+        std::cerr << "Error opening targets file: '" << targetsFile << "'\n";
         return 0;
       }
       storage.release();
     } else {
-      std::cerr << "Could not find ball file: '" << targetsFile << "'\n";
+      std::cerr << "Could not find targets file: '" << targetsFile << "'\n";
       return 0;
     }
   }
 
+  // Index the targets once so matching stays fast as more are added.
+  rv::TargetIndex targetIndex(targets);
+
   //****************************************************************************
   // Setup Camera
   //****************************************************************************
@@ -141,6 +165,11 @@ int main (int argc, char** argv) {
     return 0;
   }
 
+  // Buffers for thresholding, sized to the camera so no frame reallocates them.
+  // Only regions around the last frame's detections are searched when enabled.
+  cv::Size frameSize(static_cast<int>(capture.get(cv::CAP_PROP_FRAME_WIDTH)), static_cast<int>(capture.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  rv::RegionSearch regionSearch(frameSize, threshMethod, rescanInterval, padding, pyramidLevels);
+
   //****************************************************************************
   // Network Tables Setup
   //****************************************************************************
@@ -151,6 +180,8 @@ int main (int argc, char** argv) {
   // | TargetDetection
   // | | TargetData
   // | | | numTargets
+  // | | | reusedTargets
+  // | | | timestamp
   // | | | sortMethod
   // | | | Target0
   // | | | | tvec
@@ -162,6 +193,8 @@ int main (int argc, char** argv) {
   // | | | | pitch
   // | | | | yaw
   // | | | | match
+  // | | | | error
+  // | | | | timestamp
   // | | | | age
   // | | | Target1
   // | | | Target2
@@ -181,7 +214,6 @@ int main (int argc, char** argv) {
   // | | | contourTime
   // | | | matchTime
   // | | | poseTime
-  // | | | proccessTime
   // | | | networkTime
   // | | | totalTime
 
@@ -206,6 +238,8 @@ int main (int argc, char** argv) {
 
   // Initilize Ball Data
   targetTable->GetEntry("numTargets").SetDouble(0);
+  targetTable->GetEntry("reusedTargets").SetDouble(0);
+  targetTable->GetEntry("timestamp").SetDouble(0);
   targetTable->GetEntry("sortMethod").SetString("Closest");
 
   // Initilize Time Data
@@ -213,22 +247,45 @@ int main (int argc, char** argv) {
   timeTable->GetEntry("threshTime").SetDouble(0);
   timeTable->GetEntry("contourTime").SetDouble(0);
   timeTable->GetEntry("matchTime").SetDouble(0);
-  timeTable->GetEntry("proccessTime").SetDouble(0);
   timeTable->GetEntry("poseTime").SetDouble(0);
   timeTable->GetEntry("networkTime").SetDouble(0);
   timeTable->GetEntry("totalTime").SetDouble(0);
 
   cv::Mat frame, thresh;
+
+  // Kept between frames so thier memory is reused.
+  rv::ContourArena contours;
+  std::vector<rv::ContourFeatures> features;
+  std::vector<rv::IndexedTargetMatch> matches;
+  rv::TargetCache targetCache;
+
+  // Only used when extrapolating, to find how fast each target is moving
+  // relative to the camera. Every track is used from its first frame, when
+  // its velocity is still zero.
+  rv::Tracker tracker(12, 5, 1);
+  std::vector<cv::Point3d> detections;
+  std::vector<int> trackOf;
+  double lastTimestamp = -1;
+  std::vector<rv::IndexedTargetPose> positions, previousPositions;
+
   while (true) {
     // Start of processing time to calculate frame rate.
     auto start = std::chrono::high_resolution_clock::now();
 
     // Get the next frame
     auto captureStart = std::chrono::high_resolution_clock::now();
-    capture >> frame;
+    // The frame is stamped between grabbing and decoding it, so
+    // the time it takes to decode isn't counted in its age.
+    // A failed grab or retrieve leaves the last frame in place, so
+    // both are checked as well as the frame itself.
+    if (!capture.grab()) {
+      std::cerr << "Lost connection to camera\n";
+      break;
+    }
+    double timestamp = rv::captureTimestamp(capture);
 
     // Check camera data.
-    if (frame.empty()) {
+    if (!capture.retrieve(frame) || frame.empty()) {
       std::cerr << "Lost connection to camera\n";
       break;
     }
@@ -237,46 +294,79 @@ int main (int argc, char** argv) {
 
     // Threshold image.
     auto threshStart = std::chrono::high_resolution_clock::now();
-    rv::thresholdImage(frame, thresh, threshold);
+    regionSearch.threshold(frame, thresh, threshold);
     std::chrono::duration<double> threshTime = std::chrono::duration_cast<std::chrono::microseconds>(threshStart - std::chrono::high_resolution_clock::now());
 
     // Find contours in the image for ball detection.
     auto contourStart = std::chrono::high_resolution_clock::now();
-    std::vector<std::vector<cv::Point>> contours;
-    cv::findContours(thresh, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+    regionSearch.findContours(thresh, contours);
+    rv::findFeatures(contours, features);
     std::chrono::duration<double> contourTime = std::chrono::duration_cast<std::chrono::microseconds>(contourStart - std::chrono::high_resolution_clock::now());
 
-    // Find all the contours that are sufficently circular to be balls.
+    // Find the targets and thier corosponding points. Targets that barely
+    // moved since last frame keep thier points, only new ones are fully matched.
     auto matchStart = std::chrono::high_resolution_clock::now();
-    std::vector<rv::TargetMatch> matches = rv::findTargets(contours, targets, 50, 5);
+    targetCache.find(features, targets, targetIndex, 50, 5, matches);
     std::chrono::duration<double> matchTime = std::chrono::duration_cast<std::chrono::microseconds>(matchStart - std::chrono::high_resolution_clock::now());
 
-    // Proccess matches to have corosponding points to the target
-    auto proccessStart = std::chrono::high_resolution_clock::now();
-    std::vector<rv::TargetMatch> proccessedMatches = rv::matchTargetPoints(matches);
-    std::chrono::duration<double> proccessTime = std::chrono::duration_cast<std::chrono::microseconds>(proccessStart - std::chrono::high_resolution_clock::now());
-
     // Estimate the ball's poition from the circles.
     auto poseStart = std::chrono::high_resolution_clock::now();
-    std::vector<rv::TargetPose> positions = rv::estimateTargetPose(proccessedMatches, camera.matrix, camera.distortion);
+    // Last frame's poses are refined rather than solving each from scratch.
+    std::swap(positions, previousPositions);
+    rv::estimateTargetPose(targets, matches, camera.matrix, camera.distortion, previousPositions, 2.0, positions);
+
+    // Search around these detections in the next frame.
+    std::vector<cv::Rect> bounds = rv::boundingRects(features, matches);
+    regionSearch.update(bounds);
+
+    // Follow the targets between frames for thier velocities.
+    trackOf.assign(positions.size(), -1);
+    if (extrapolate) {
+      detections.resize(positions.size());
+      for (int i = 0; i < positions.size(); i++) {
+        detections[i] = cv::Point3d(positions[i].tvec.at<double>(0), positions[i].tvec.at<double>(1), positions[i].tvec.at<double>(2));
+      }
+
+      double dt = lastTimestamp >= 0 ? timestamp - lastTimestamp : 0;
+      lastTimestamp = timestamp;
+      tracker.update(detections, bounds, dt);
+
+      for (int t = 0; t < tracker.tracks().size(); t++) {
+        if (tracker.tracks()[t].detection >= 0) {
+          trackOf[tracker.tracks()[t].detection] = t;
+        }
+      }
+    }
     std::chrono::duration<double> poseTime = std::chrono::duration_cast<std::chrono::microseconds>(poseStart - std::chrono::high_resolution_clock::now());
 
     // Send data over the network
     auto networkStart = std::chrono::high_resolution_clock::now();
-    targetTable->GetEntry("numBalls").SetDouble(positions.size());
+    // When extrapolating, each target is moved to where it should be now,
+    // to make up for the time the frame spent being processed.
+    double now = rv::steadyTime();
+    double age = now - timestamp;
+    targetTable->GetEntry("numTargets").SetDouble(positions.size());
+    targetTable->GetEntry("timestamp").SetDouble(timestamp);
+    targetTable->GetEntry("reusedTargets").SetDouble(targetCache.reused());
     
     // TODO: Add actual data
     for (int i = 0; i < positions.size(); i++) {
       auto table = tableInstance.GetTable("TargetDetection/TargetData/Target" + std::to_string(i));
       
       // Position data
-      table->GetEntry("tvec").SetDoubleArray({positions[i].tvec.at<double>(0,0), positions[i].tvec.at<double>(0,1), positions[i].tvec.at<double>(0,2)});
-      table->GetEntry("x").SetDouble(positions[i].tvec.at<double>(0,0));
-      table->GetEntry("y").SetDouble(positions[i].tvec.at<double>(0,1));
-      table->GetEntry("z").SetDouble(positions[i].tvec.at<double>(0,2));
+      cv::Point3d position(positions[i].tvec.at<double>(0,0), positions[i].tvec.at<double>(0,1), positions[i].tvec.at<double>(0,2));
+      if (trackOf[i] >= 0) {
+        position += tracker.tracks()[trackOf[i]].velocity * age;
+      }
+      table->GetEntry("tvec").SetDoubleArray({position.x, position.y, position.z});
+      table->GetEntry("x").SetDouble(position.x);
+      table->GetEntry("y").SetDouble(position.y);
+      table->GetEntry("z").SetDouble(position.z);
 
       // Extract rotation from rvec
-      cv::Vec3d rotation = cv::RQDecomp3x3(positions[i].rvec, cv::noArray(), cv::noArray());
+      cv::Mat rotationMatrix;
+      cv::Rodrigues(positions[i].rvec, rotationMatrix);
+      cv::Vec3d rotation = cv::RQDecomp3x3(rotationMatrix, cv::noArray(), cv::noArray());
 
       // Rotation data
       table->GetEntry("rvec").SetDoubleArray({positions[i].rvec.at<double>(0,0), positions[i].rvec.at<double>(0,1), positions[i].rvec.at<double>(0,2)});
@@ -285,9 +375,13 @@ int main (int argc, char** argv) {
       table->GetEntry("yaw").SetDouble(rotation[2]);
 
       // Other info
-      table->GetEntry("match").SetDouble(positions[i].match.match);
-      std::time_t t = time(NULL);
-      table->GetEntry("age").SetString(std::asctime(std::gmtime(&t)));
+      table->GetEntry("match").SetDouble(matches[positions[i].match].match);
+      table->GetEntry("error").SetDouble(positions[i].error);
+
+      // Time data, in seconds on the steady clock. The timestamp is when the
+      // position is for, and the age is how long ago the frame was captured.
+      table->GetEntry("timestamp").SetDouble(extrapolate ? now : timestamp);
+      table->GetEntry("age").SetDouble(age);
     }
 
     // Send time data
@@ -295,7 +389,6 @@ int main (int argc, char** argv) {
     timeTable->GetEntry("threshTime").SetDouble((threshTime.count() / 1000000));
     timeTable->GetEntry("contourTime").SetDouble((contourTime.count() / 1000000));
     timeTable->GetEntry("matchTime").SetDouble((matchTime.count() / 1000000));
-    timeTable->GetEntry("proccessTime").SetDouble((proccessTime.count() / 1000000));
     timeTable->GetEntry("poseTime").SetDouble((poseTime.count() / 1000000));
 
     auto networkTime = std::chrono::duration_cast<std::chrono::microseconds>(networkStart - std::chrono::high_resolution_clock::now());